@@ -0,0 +1,193 @@
+#include "activity.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+// Weight of the latest difference in the motion energy
+static const double ENERGY_ALPHA = 0.3;
+// Differences below this per pixel are treated as sensor noise
+static const uint32_t NOISE_PER_PIXEL = 2;
+// Lead over the current stream needed on top of the hysteresis factor
+static const double MIN_LEAD = 0.5;
+
+void activity_thumbnail(const uint8_t *bgr0, int width, int height, int stride, uint8_t thumb[ACTIVITY_THUMB_SIZE]) {
+  for (int ty = 0; ty < ACTIVITY_THUMB_HEIGHT; ty++) {
+    // Average 2x2 pixels from the middle of each block
+    int y0 = (ty * 4 + 1) * height / (ACTIVITY_THUMB_HEIGHT * 4);
+    int y1 = (ty * 4 + 3) * height / (ACTIVITY_THUMB_HEIGHT * 4);
+    const uint8_t *row0 = bgr0 + (int64_t)y0 * stride;
+    const uint8_t *row1 = bgr0 + (int64_t)y1 * stride;
+
+    for (int tx = 0; tx < ACTIVITY_THUMB_WIDTH; tx++) {
+      int x0 = (tx * 4 + 1) * width / (ACTIVITY_THUMB_WIDTH * 4) * 4;
+      int x1 = (tx * 4 + 3) * width / (ACTIVITY_THUMB_WIDTH * 4) * 4;
+      const uint8_t *p[] = {&row0[x0], &row0[x1], &row1[x0], &row1[x1]};
+
+      int luma = 0;
+      for (int i = 0; i < 4; i++)
+        luma += 29 * p[i][0] + 150 * p[i][1] + 77 * p[i][2];
+      thumb[ty * ACTIVITY_THUMB_WIDTH + tx] = luma >> 10;
+    }
+  }
+}
+
+int activity_thumbnail_node(const mpv_node *node, uint8_t thumb[ACTIVITY_THUMB_SIZE]) {
+  if (node->format != MPV_FORMAT_NODE_MAP)
+    return -1;
+
+  int64_t width = 0, height = 0, stride = 0;
+  const char *format = NULL;
+  const mpv_byte_array *data = NULL;
+  for (int i = 0; i < node->u.list->num; i++) {
+    const char *key = node->u.list->keys[i];
+    const mpv_node *value = &node->u.list->values[i];
+    if (strcmp(key, "w") == 0 && value->format == MPV_FORMAT_INT64)
+      width = value->u.int64;
+    else if (strcmp(key, "h") == 0 && value->format == MPV_FORMAT_INT64)
+      height = value->u.int64;
+    else if (strcmp(key, "stride") == 0 && value->format == MPV_FORMAT_INT64)
+      stride = value->u.int64;
+    else if (strcmp(key, "format") == 0 && value->format == MPV_FORMAT_STRING)
+      format = value->u.string;
+    else if (strcmp(key, "data") == 0 && value->format == MPV_FORMAT_BYTE_ARRAY)
+      data = value->u.ba;
+  }
+  if (!format || !data || width <= 0 || height <= 0)
+    return -1;
+
+  if (strcmp(format, "y8") == 0 && width == ACTIVITY_THUMB_WIDTH && height == ACTIVITY_THUMB_HEIGHT && data->size >= ACTIVITY_THUMB_SIZE) {
+    memcpy(thumb, data->data, ACTIVITY_THUMB_SIZE);
+    return 0;
+  }
+  if (strcmp(format, "bgr0") == 0 && stride >= width * 4 && data->size >= stride * height) {
+    activity_thumbnail(data->data, width, height, stride, thumb);
+    return 0;
+  }
+  return -1;
+}
+
+static uint32_t diff_scalar(const uint8_t *a, const uint8_t *b, int size) {
+  uint32_t sum = 0;
+  for (int i = 0; i < size; i++)
+    sum += abs(a[i] - b[i]);
+  return sum;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+
+__attribute__((target("sse2"))) static uint32_t diff_sse2(const uint8_t *a, const uint8_t *b, int size) {
+  __m128i sum = _mm_setzero_si128();
+  int i = 0;
+  for (; i + 16 <= size; i += 16) {
+    __m128i va = _mm_loadu_si128((const __m128i *)&a[i]);
+    __m128i vb = _mm_loadu_si128((const __m128i *)&b[i]);
+    sum = _mm_add_epi64(sum, _mm_sad_epu8(va, vb));
+  }
+  uint32_t total = _mm_cvtsi128_si32(sum) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(sum, sum));
+  return total + diff_scalar(&a[i], &b[i], size - i);
+}
+
+__attribute__((target("avx2"))) static uint32_t diff_avx2(const uint8_t *a, const uint8_t *b, int size) {
+  __m256i sum = _mm256_setzero_si256();
+  int i = 0;
+  for (; i + 32 <= size; i += 32) {
+    __m256i va = _mm256_loadu_si256((const __m256i *)&a[i]);
+    __m256i vb = _mm256_loadu_si256((const __m256i *)&b[i]);
+    sum = _mm256_add_epi64(sum, _mm256_sad_epu8(va, vb));
+  }
+  __m128i half = _mm_add_epi64(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+  uint32_t total = _mm_cvtsi128_si32(half) + _mm_cvtsi128_si32(_mm_unpackhi_epi64(half, half));
+  return total + diff_scalar(&a[i], &b[i], size - i);
+}
+
+#elif defined(__ARM_NEON)
+
+static uint32_t diff_neon(const uint8_t *a, const uint8_t *b, int size) {
+  uint32x4_t sum = vdupq_n_u32(0);
+  int i = 0;
+  for (; i + 16 <= size; i += 16) {
+    uint8x16_t diff = vabdq_u8(vld1q_u8(&a[i]), vld1q_u8(&b[i]));
+    sum = vpadalq_u16(sum, vpaddlq_u8(diff));
+  }
+  uint32_t total = vgetq_lane_u32(sum, 0) + vgetq_lane_u32(sum, 1) + vgetq_lane_u32(sum, 2) + vgetq_lane_u32(sum, 3);
+  return total + diff_scalar(&a[i], &b[i], size - i);
+}
+
+#endif
+
+static uint32_t (*diff_kernel)(const uint8_t *, const uint8_t *, int);
+static const char *diff_kernel_name;
+
+static void pick_kernel() {
+  diff_kernel = diff_scalar;
+  diff_kernel_name = "scalar";
+#if defined(__x86_64__) || defined(__i386__)
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2")) {
+    diff_kernel = diff_avx2;
+    diff_kernel_name = "avx2";
+  } else if (__builtin_cpu_supports("sse2")) {
+    diff_kernel = diff_sse2;
+    diff_kernel_name = "sse2";
+  }
+#elif defined(__ARM_NEON)
+  diff_kernel = diff_neon;
+  diff_kernel_name = "neon";
+#endif
+}
+
+uint32_t activity_diff(const uint8_t *a, const uint8_t *b, int size) {
+  if (!diff_kernel)
+    pick_kernel();
+  return diff_kernel(a, b, size);
+}
+
+const char *activity_kernel() {
+  if (!diff_kernel)
+    pick_kernel();
+  return diff_kernel_name;
+}
+
+double activity_energy(double energy, uint32_t diff) {
+  uint32_t noise = NOISE_PER_PIXEL * ACTIVITY_THUMB_SIZE;
+  double motion = diff > noise ? (double)(diff - noise) / ACTIVITY_THUMB_SIZE : 0;
+  return energy * (1 - ENERGY_ALPHA) + motion * ENERGY_ALPHA;
+}
+
+int activity_assign(const double scores[], int order[], int count, const int panes[], int pane_count, double hysteresis) {
+  int changes = 0;
+  int placed[count];
+  for (int i = 0; i < count; i++)
+    placed[i] = 0;
+
+  for (int p = 0; p < MIN(pane_count, count); p++) {
+    int pane = panes[p];
+    int incumbent = order[pane];
+
+    // Most active stream that is not already in a more important pane
+    int best = -1;
+    for (int i = 0; i < count; i++)
+      if (!placed[i] && (best < 0 || scores[i] > scores[best]))
+        best = i;
+
+    if (best != incumbent && !placed[incumbent] && scores[best] > scores[incumbent] * (1 + hysteresis) + MIN_LEAD) {
+      // Swap so the incumbent takes the position the winner had
+      for (int i = 0; i < count; i++)
+        if (order[i] == best) {
+          order[i] = incumbent;
+          break;
+        }
+      order[pane] = best;
+      changes++;
+    }
+    placed[order[pane]] = 1;
+  }
+
+  return changes;
+}
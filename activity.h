@@ -0,0 +1,30 @@
+#pragma once
+
+#include <mpv/client.h>
+#include <stdint.h>
+
+#define ACTIVITY_THUMB_WIDTH 48
+#define ACTIVITY_THUMB_HEIGHT 32
+#define ACTIVITY_THUMB_SIZE (ACTIVITY_THUMB_WIDTH * ACTIVITY_THUMB_HEIGHT)
+
+// Downsamples a bgr0 frame to a luma thumbnail.
+void activity_thumbnail(const uint8_t *bgr0, int width, int height, int stride, uint8_t thumb[ACTIVITY_THUMB_SIZE]);
+
+// Reads the result of screenshot-raw, either a bgr0 frame or an already
+// downsampled y8 thumbnail. Returns -1 when it is neither.
+int activity_thumbnail_node(const mpv_node *node, uint8_t thumb[ACTIVITY_THUMB_SIZE]);
+
+// Sum of absolute differences between two thumbnails.
+uint32_t activity_diff(const uint8_t *a, const uint8_t *b, int size);
+
+// Name of the kernel picked for this CPU.
+const char *activity_kernel();
+
+// Smooths the difference of the latest thumbnail into a motion energy score.
+double activity_energy(double energy, uint32_t diff);
+
+// Reorders streams so the most active ones take the first panes of panes, which
+// lists pane indexes from most to least important. order maps panes to streams.
+// A stream only takes a pane when it beats the current one by the hysteresis
+// factor. Returns the number of panes that changed.
+int activity_assign(const double scores[], int order[], int count, const int panes[], int pane_count, double hysteresis);
@@ -0,0 +1,994 @@
+#define _GNU_SOURCE
+#include "activity.h"
+#include "cluster.h"
+#include "config.h"
+#include "layout.h"
+#include "memory.h"
+#include "player_mock.h"
+#include "pool.h"
+#include "stream.h"
+#include "trace.h"
+#include "util.h"
+#include "view.h"
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+// Results are written to stdout as one JSON object per line so nightly runs
+// can be diffed or loaded into any tool that understands JSON lines.
+
+static int failures = 0;
+
+static int64_t now_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void report(const char *name, const char *param, long value, long iterations, int64_t elapsed_ns) {
+  printf("{\"name\":\"%s\",\"%s\":%ld,\"iterations\":%ld,\"ns_per_op\":%.2f}\n",
+         name, param, value, iterations, (double)elapsed_ns / iterations);
+}
+
+static void check(int ok, const char *name, long value, const char *msg) {
+  if (ok)
+    return;
+  fprintf(stderr, "%s(%ld): %s\n", name, value, msg);
+  failures++;
+}
+
+// Keeps the compiler from discarding results of the measured calls.
+static volatile int sink;
+
+// Speed changes, reloads and view switches are logged, keep the terminal out of the measurement.
+static int quiet_stderr() {
+  fflush(stderr);
+  int saved = dup(STDERR_FILENO);
+  int null = open("/dev/null", O_WRONLY);
+  dup2(null, STDERR_FILENO);
+  close(null);
+  return saved;
+}
+
+static void restore_stderr(int saved) {
+  fflush(stderr);
+  dup2(saved, STDERR_FILENO);
+  close(saved);
+}
+
+static void bench_layout_grid(int count) {
+  const int width = 1920;
+  const int height = 1080;
+
+  LayoutGrid grid = layout_grid_new(width, height, count);
+  int rows = (count + grid.columns - 1) / grid.columns;
+  check(grid.columns * rows >= count, "layout_grid_new", count, "grid does not fit all panes");
+  for (int i = 0; i < count; i++) {
+    LayoutWindow w = layout_grid_window(grid, i);
+    check(w.x >= 0 && w.y >= 0 && w.x + w.width <= width && w.y + w.height <= height,
+          "layout_grid_window", count, "pane outside of window");
+  }
+
+  long iterations = 1000000 / count + 1000;
+
+  int64_t start = now_ns();
+  for (long i = 0; i < iterations; i++)
+    sink += layout_grid_new(width, height, count).columns;
+  report("layout_grid_new", "panes", count, iterations, now_ns() - start);
+
+  start = now_ns();
+  for (long i = 0; i < iterations; i++)
+    for (int pane = 0; pane < count; pane++)
+      sink += layout_grid_window(grid, pane).x;
+  report("layout_grid_window", "panes", count, iterations * count, now_ns() - start);
+}
+
+// Typical sub stream sizes, mostly 16:9 with some 4:3, D1 and portrait cameras.
+static LayoutSource bench_source(int index) {
+  static const LayoutSource sources[] = {{640, 360}, {704, 576}, {640, 360}, {640, 480}, {360, 640}, {1280, 720}};
+  return sources[index % (sizeof(sources) / sizeof(sources[0]))];
+}
+
+static void bench_layout_solve(int width, int height, int count) {
+  LayoutSource *sources = malloc(sizeof(LayoutSource) * count);
+  for (int i = 0; i < count; i++)
+    sources[i] = bench_source(i);
+
+  LayoutGrid naive = layout_grid_new(width, height, count);
+  LayoutGrid solved = layout_grid_solve(width, height, count, sources);
+  double naive_area = layout_grid_displayed_area(naive, count, sources);
+  double solved_area = layout_grid_displayed_area(solved, count, sources);
+  // Clean scales may win over a slightly larger area, but never by more than the bonus
+  check(solved_area * 1.02 >= naive_area, "layout_grid_solve", count, "shows less video than layout_grid_new");
+  check(solved.columns * solved.rows >= count, "layout_grid_solve", count, "grid does not fit all panes");
+
+  // Panes must tile the window without gaps
+  int64_t covered = 0;
+  for (int i = 0; i < solved.columns * solved.rows; i++) {
+    LayoutWindow w = layout_grid_window(solved, i);
+    covered += (int64_t)w.width * w.height;
+  }
+  check(covered == (int64_t)width * height, "layout_grid_window", count, "panes leave pixels uncovered");
+
+  long iterations = 100000 / (count * count) + 10;
+  int64_t start = now_ns();
+  for (long i = 0; i < iterations; i++)
+    sink += layout_grid_solve(width, height, count, sources).columns;
+  int64_t elapsed = now_ns() - start;
+  printf("{\"name\":\"layout_grid_solve\",\"window\":\"%dx%d\",\"panes\":%d,\"iterations\":%ld,\"ns_per_op\":%.2f,"
+         "\"columns\":%d,\"displayed\":%.4f,\"naive_columns\":%d,\"naive_displayed\":%.4f}\n",
+         width, height, count, iterations, (double)elapsed / iterations, solved.columns, solved_area / ((double)width * height),
+         naive.columns, naive_area / ((double)width * height));
+
+  free(sources);
+}
+
+static char *write_temp(void (*generate)(FILE *, int), int size) {
+  char *path = strdup("/tmp/camviewport-bench-XXXXXX");
+  int fd = mkstemp(path);
+  if (fd < 0)
+    die("failed to create temp file");
+  FILE *file = fdopen(fd, "w");
+  generate(file, size);
+  fclose(file);
+  return path;
+}
+
+static void generate_layout(FILE *file, int lines) {
+  fprintf(file, "name = bench\n");
+  for (int i = 0; i < lines / 4; i++) {
+    fprintf(file, "[%d]\n", i % MAX_STREAMS + 1);
+    fprintf(file, "x = %d/%d\n", i % 7, 7);
+    fprintf(file, "y = 0.%d\n", i % 10);
+    fprintf(file, "w = 1/%d\n", i % 7 + 1);
+    fprintf(file, "h = 1/3\n");
+  }
+}
+
+static void bench_layout_file(int lines) {
+  char *path = write_temp(generate_layout, lines);
+
+  long iterations = 2000000 / lines + 10;
+  int64_t elapsed = 0;
+  for (long i = 0; i < iterations; i++) {
+    LayoutFile file = {};
+    int64_t start = now_ns();
+    int err = layout_file_reload(&file, path);
+    elapsed += now_ns() - start;
+    check(err == 0, "layout_file_reload", lines, "failed to parse generated file");
+    check(file.pane_count == MIN(lines / 4, MAX_STREAMS), "layout_file_reload", lines, "unexpected pane count");
+    free(file.name);
+  }
+  report("layout_file_reload", "lines", lines, iterations, elapsed);
+
+  unlink(path);
+  free(path);
+}
+
+static void generate_config(FILE *file, int flags) {
+  fprintf(file, "key-q = quit\nkey-space = home\nlayout = layouts/1+5.ini\n");
+  for (int i = 0; i < flags; i++) {
+    fprintf(file, "mpv-opt-%d = %d\n", i, i);
+    fprintf(file, "main-mpv-opt-%d = %d\n", i, i);
+    fprintf(file, "sub-mpv-opt-%d = %d\n", i, i);
+  }
+  for (int stream = 0; stream < MAX_STREAMS; stream++) {
+    fprintf(file, "[CAM-%02d]\n", stream);
+    fprintf(file, "main = rtsp://127.0.0.1:554/cam/realmonitor?channel=%d&subtype=0\n", stream);
+    fprintf(file, "sub = rtsp://127.0.0.1:554/cam/realmonitor?channel=%d&subtype=1\n", stream);
+    for (int i = 0; i < flags; i++) {
+      fprintf(file, "mpv-opt-%d = %d\n", i, i);
+      fprintf(file, "main-mpv-opt-%d = %d\n", i, i);
+      fprintf(file, "sub-mpv-opt-%d = %d\n", i, i);
+    }
+  }
+}
+
+static void bench_config_file(int flags) {
+  char *path = write_temp(generate_config, flags);
+  Config *config = malloc(sizeof(Config));
+
+  // Parsed strings are leaked on purpose, the config owns them for the
+  // lifetime of the program and has no free function.
+  long iterations = 20000 / (flags + 1) + 10;
+  int64_t elapsed = 0;
+  for (long i = 0; i < iterations; i++) {
+    memset(config, 0, sizeof(Config));
+    int64_t start = now_ns();
+    int err = config_parse_file(config, path);
+    elapsed += now_ns() - start;
+    check(err == 0, "config_parse_file", flags, "failed to parse generated file");
+    check(config->stream_count == MAX_STREAMS, "config_parse_file", flags, "unexpected stream count");
+    check(config->streams[MAX_STREAMS - 1].sub_mpv_flags.count == flags, "config_parse_file", flags, "unexpected flag count");
+  }
+  report("config_parse_file", "flags", flags, iterations, elapsed);
+
+  // Merging is done once per stream when loading the config
+  ConfigMpvFlags merged;
+  iterations = 200000 / (flags + 1) + 10;
+  int64_t start = now_ns();
+  for (long i = 0; i < iterations; i++) {
+    merged.count = 0;
+    config_unique_merge_mpv_flags(&merged, config->mpv_flags);
+    config_unique_merge_mpv_flags(&merged, config->streams[0].mpv_flags);
+    sink += merged.count;
+  }
+  report("config_unique_merge_mpv_flags", "flags", flags, iterations, now_ns() - start);
+  check(merged.count == flags, "config_unique_merge_mpv_flags", flags, "duplicate flags were merged");
+
+  free(config);
+  unlink(path);
+  free(path);
+}
+
+// Scalar reference for the SIMD kernels.
+static uint32_t reference_diff(const uint8_t *a, const uint8_t *b, int size) {
+  uint32_t sum = 0;
+  for (int i = 0; i < size; i++)
+    sum += a[i] > b[i] ? a[i] - b[i] : b[i] - a[i];
+  return sum;
+}
+
+static void bench_activity(int cameras) {
+  uint8_t *thumbs = malloc((size_t)cameras * 2 * ACTIVITY_THUMB_SIZE);
+  srand(cameras);
+  for (int i = 0; i < cameras * 2 * ACTIVITY_THUMB_SIZE; i++)
+    thumbs[i] = rand();
+
+  for (int i = 0; i < cameras; i++) {
+    uint8_t *a = thumbs + (size_t)i * 2 * ACTIVITY_THUMB_SIZE;
+    check(activity_diff(a, a + ACTIVITY_THUMB_SIZE, ACTIVITY_THUMB_SIZE) == reference_diff(a, a + ACTIVITY_THUMB_SIZE, ACTIVITY_THUMB_SIZE),
+          "activity_diff", cameras, "kernel does not match the scalar reference");
+  }
+
+  // One iteration scores every camera, which is what a sampling cycle costs
+  long iterations = 100000 / cameras + 100;
+  int64_t start = now_ns();
+  for (long i = 0; i < iterations; i++)
+    for (int camera = 0; camera < cameras; camera++) {
+      uint8_t *a = thumbs + (size_t)camera * 2 * ACTIVITY_THUMB_SIZE;
+      sink += activity_diff(a, a + ACTIVITY_THUMB_SIZE, ACTIVITY_THUMB_SIZE);
+    }
+  int64_t elapsed = now_ns() - start;
+  printf("{\"name\":\"activity_diff\",\"kernel\":\"%s\",\"cameras\":%d,\"iterations\":%ld,\"ns_per_op\":%.2f}\n",
+         activity_kernel(), cameras, iterations, (double)elapsed / iterations);
+
+  uint8_t *frame = malloc(1280 * 720 * 4);
+  for (int i = 0; i < 1280 * 720 * 4; i++)
+    frame[i] = rand();
+  uint8_t thumb[ACTIVITY_THUMB_SIZE];
+  iterations = 2000 / cameras + 10;
+  start = now_ns();
+  for (long i = 0; i < iterations; i++)
+    for (int camera = 0; camera < cameras; camera++) {
+      activity_thumbnail(frame, 1280, 720, 1280 * 4, thumb);
+      sink += thumb[0];
+    }
+  report("activity_thumbnail", "cameras", cameras, iterations, now_ns() - start);
+
+  free(frame);
+  free(thumbs);
+}
+
+// Stand-ins for the libmpv calls of player_mpv.c. Every screenshot is a
+// 1280x720 bgr0 frame, async replies are queued per handle.
+typedef struct {
+  int replies;
+} FakeMpv;
+
+static uint8_t *fake_frame;
+static mpv_byte_array fake_frame_data;
+static mpv_node fake_frame_values[5];
+static char *fake_frame_keys[] = {"w", "h", "stride", "format", "data"};
+static mpv_node_list fake_frame_list = {.num = 5, .keys = fake_frame_keys, .values = fake_frame_values};
+static mpv_node fake_screenshot = {.format = MPV_FORMAT_NODE_MAP, .u.list = &fake_frame_list};
+
+static void fake_mpv_init() {
+  fake_frame = malloc(1280 * 720 * 4);
+  for (int i = 0; i < 1280 * 720 * 4; i++)
+    fake_frame[i] = rand();
+  fake_frame_data = (mpv_byte_array){.data = fake_frame, .size = 1280 * 720 * 4};
+  fake_frame_values[0] = (mpv_node){.format = MPV_FORMAT_INT64, .u.int64 = 1280};
+  fake_frame_values[1] = (mpv_node){.format = MPV_FORMAT_INT64, .u.int64 = 720};
+  fake_frame_values[2] = (mpv_node){.format = MPV_FORMAT_INT64, .u.int64 = 1280 * 4};
+  fake_frame_values[3] = (mpv_node){.format = MPV_FORMAT_STRING, .u.string = "bgr0"};
+  fake_frame_values[4] = (mpv_node){.format = MPV_FORMAT_BYTE_ARRAY, .u.ba = &fake_frame_data};
+}
+
+int mpv_command(mpv_handle *ctx, const char **args) {
+  return 0;
+}
+
+int mpv_command_async(mpv_handle *ctx, uint64_t reply_userdata, const char **args) {
+  if (strcmp(args[0], "screenshot-raw") == 0)
+    ((FakeMpv *)ctx)->replies++;
+  return 0;
+}
+
+int mpv_command_ret(mpv_handle *ctx, const char **args, mpv_node *result) {
+  *result = fake_screenshot;
+  return 0;
+}
+
+void mpv_free_node_contents(mpv_node *node) {}
+
+int mpv_set_property_string(mpv_handle *ctx, const char *name, const char *data) {
+  return 0;
+}
+
+mpv_event *mpv_wait_event(mpv_handle *ctx, double timeout) {
+  static mpv_event event;
+  static mpv_event_command command = {.result = {.format = MPV_FORMAT_NODE_MAP, .u.list = &fake_frame_list}};
+  FakeMpv *mpv = (FakeMpv *)ctx;
+  memset(&event, 0, sizeof(event));
+  if (mpv->replies > 0) {
+    mpv->replies--;
+    event.event_id = MPV_EVENT_COMMAND_REPLY;
+    event.data = &command;
+  }
+  return &event;
+}
+
+void mpv_destroy(mpv_handle *ctx) {}
+
+// What a sampling cycle of auto layout costs the main loop with in-process
+// players: requesting a screenshot of every camera and reading the replies.
+// Without a pool the main thread shrinks every frame itself.
+static void bench_activity_capture(int cameras, int threads) {
+  Pool *pool = threads > 0 ? pool_new(threads) : NULL;
+  FakeMpv *handles = calloc(cameras, sizeof(FakeMpv));
+  StreamState *streams = calloc(cameras, sizeof(StreamState));
+  for (int i = 0; i < cameras; i++) {
+    streams[i].name = "BENCH";
+    streams[i].player = player_mpv_new(streams[i].name, (mpv_handle *)&handles[i], pool);
+  }
+
+  const int cycles = 50;
+  int64_t main_ns = 0;
+  int64_t pool_ns = 0;
+  for (int cycle = 0; cycle < cycles; cycle++) {
+    int64_t start = now_ns();
+    for (int i = 0; i < cameras; i++)
+      player_command_async(streams[i].player, (const char *[]){"screenshot-raw", "video", NULL});
+    int64_t requested = now_ns();
+    if (pool)
+      pool_wait(pool);
+    int64_t captured = now_ns();
+    for (int i = 0; i < cameras; i++)
+      stream_step(&streams[i], 1, 0);
+    main_ns += now_ns() - captured + requested - start;
+    pool_ns += captured - requested;
+  }
+
+  for (int i = 0; i < cameras; i++)
+    check(streams[i].has_thumb, "activity_capture", cameras, "no thumbnail was received");
+  if (pool)
+    check(main_ns / cycles < 1000000, "activity_capture", cameras, "sampling takes more than 1 ms of the main loop");
+  printf("{\"name\":\"activity_capture\",\"mode\":\"%s\",\"cameras\":%d,\"threads\":%d,\"main_ns_per_cycle\":%.0f,\"pool_ns_per_cycle\":%.0f}\n",
+         pool ? "pool" : "inline", cameras, pool ? pool_thread_count(pool) : 0, (double)main_ns / cycles, (double)pool_ns / cycles);
+
+  for (int i = 0; i < cameras; i++)
+    player_destroy(streams[i].player);
+  if (pool)
+    pool_free(pool);
+  free(streams);
+  free(handles);
+}
+
+typedef enum {
+  SIMULATED_STEADY,
+  SIMULATED_LAGGING,
+  SIMULATED_STALLING,
+  SIMULATED_KINDS,
+} SimulatedKind;
+
+// Drives the per-stream logic of the main loop with mock players for a
+// simulated minute, at the same 60 Hz as the real loop.
+static void bench_streams(int count) {
+  const int64_t tick_ms = 1000 / 60;
+  const int64_t duration_ms = 60 * 1000;
+
+  StreamState *streams = calloc(count, sizeof(StreamState));
+  char (*names)[16] = malloc(count * sizeof(*names));
+  for (int i = 0; i < count; i++) {
+    snprintf(names[i], sizeof(names[i]), "SIM-%04d", i);
+    streams[i].name = names[i];
+    streams[i].sub = "mock://sub";
+    streams[i].speed = 1.0;
+    streams[i].player = player_mock_new(names[i], 640, 360);
+    switch (i % SIMULATED_KINDS) {
+    case SIMULATED_LAGGING:
+      player_mock_script(streams[i].player, 10000, MOCK_DELAY, 1.5);
+      player_mock_script(streams[i].player, 40000, MOCK_DELAY, 2.0);
+      break;
+    case SIMULATED_STALLING:
+      player_mock_script(streams[i].player, 10000, MOCK_STALL, 0);
+      player_mock_script(streams[i].player, 20000, MOCK_RESUME, 0);
+      break;
+    }
+    player_loadfile(streams[i].player, streams[i].sub);
+  }
+
+  int saved_stderr = quiet_stderr();
+
+  long speed_changes[SIMULATED_KINDS] = {};
+  long ticks = 0;
+  int64_t start = now_ns();
+  for (int64_t now_ms = 0; now_ms <= duration_ms; now_ms += tick_ms) {
+    for (int i = 0; i < count; i++) {
+      StreamState *stream = &streams[i];
+      player_mock_advance(stream->player, now_ms);
+      StreamChange change = stream_step(stream, 1, now_ms / 1000);
+      if (change & STREAM_CHANGED_RELOAD)
+        player_loadfile(stream->player, stream->sub);
+      if (change & STREAM_CHANGED_SPEED) {
+        player_set_speed(stream->player, stream->speed);
+        speed_changes[i % SIMULATED_KINDS]++;
+      }
+    }
+    ticks++;
+  }
+  int64_t elapsed = now_ns() - start;
+
+  restore_stderr(saved_stderr);
+
+  report("stream_step", "streams", count, ticks * count, elapsed);
+
+  for (int i = 0; i < count; i++) {
+    int loads = player_mock_loads(streams[i].player);
+    switch (i % SIMULATED_KINDS) {
+    case SIMULATED_STEADY:
+      check(loads == 1, "stream_step", count, "steady stream was reloaded");
+      check(streams[i].source.width == 640 && streams[i].source.height == 360, "stream_step", count, "video size was not observed");
+      break;
+    case SIMULATED_LAGGING:
+      check(loads == 1, "stream_step", count, "lagging stream was reloaded");
+      check(player_mock_speed(streams[i].player) == streams[i].speed, "stream_step", count, "player speed out of sync");
+      break;
+    case SIMULATED_STALLING:
+      check(loads > 1, "stream_step", count, "stalled stream was not reloaded");
+      check(streams[i].delay < 0.5, "stream_step", count, "stream did not recover after reload");
+      break;
+    }
+    player_destroy(streams[i].player);
+  }
+  check(speed_changes[SIMULATED_STEADY] == 0, "stream_step", count, "steady stream changed speed");
+  if (count >= SIMULATED_KINDS)
+    check(speed_changes[SIMULATED_LAGGING] > 0, "stream_step", count, "lagging stream was not caught up");
+
+  free(names);
+  free(streams);
+}
+
+// Latency is demuxer-cache-time minus playback-time and only playback-time
+// proves frames are still shown. Walks one mock stream across both speed
+// thresholds, then freezes its decoder while data keeps arriving.
+static void bench_stream_thresholds() {
+  const int64_t tick_ms = 1000 / 60;
+  const int64_t freeze_ms = 30000;
+
+  StreamState stream = {.name = "THRESHOLDS", .sub = "mock://sub", .speed = 1.0};
+  stream.player = player_mock_new(stream.name, 640, 360);
+  // Just under the threshold, then over it until caught up
+  player_mock_script(stream.player, 5000, MOCK_DELAY, MPV_MAX_DELAY_SEC - 0.05);
+  player_mock_script(stream.player, 15000, MOCK_DELAY, MPV_MAX_DELAY_SEC + 0.1);
+  player_mock_script(stream.player, freeze_ms, MOCK_FREEZE, 0);
+  player_mock_script(stream.player, freeze_ms + 10000, MOCK_RESUME, 0);
+  player_loadfile(stream.player, stream.sub);
+
+  int saved_stderr = quiet_stderr();
+
+  int64_t sped_up_ms = -1;
+  int64_t slowed_down_ms = -1;
+  int64_t reloaded_ms = -1;
+  int early_switches = 0;
+  for (int64_t now_ms = 0; now_ms <= 60000; now_ms += tick_ms) {
+    player_mock_advance(stream.player, now_ms);
+    StreamChange change = stream_step(&stream, 1, now_ms / 1000);
+    if (change & STREAM_CHANGED_RELOAD) {
+      player_loadfile(stream.player, stream.sub);
+      if (reloaded_ms < 0)
+        reloaded_ms = now_ms;
+    }
+    if (change & STREAM_CHANGED_SPEED) {
+      player_set_speed(stream.player, stream.speed);
+      if (stream.speed > 1.0) {
+        early_switches += stream.delay <= MPV_MAX_DELAY_SEC;
+        if (sped_up_ms < 0)
+          sped_up_ms = now_ms;
+      } else {
+        early_switches += stream.delay >= MPV_MIN_DISPLAY_SEC;
+        if (slowed_down_ms < 0)
+          slowed_down_ms = now_ms;
+      }
+    }
+  }
+
+  restore_stderr(saved_stderr);
+
+  check(early_switches == 0, "stream_thresholds", 1, "speed switched on the wrong side of a threshold");
+  check(sped_up_ms >= 15000 && sped_up_ms < 16000, "stream_thresholds", 1, "did not speed up once the delay passed the maximum");
+  check(slowed_down_ms > sped_up_ms && slowed_down_ms < freeze_ms, "stream_thresholds", 1, "did not slow down once caught up");
+  // demuxer-cache-time keeps arriving while frozen, it must not hold off the watchdog
+  check(reloaded_ms > freeze_ms + (MPV_TIMEOUT_SEC - 1) * 1000 && reloaded_ms <= freeze_ms + (MPV_TIMEOUT_SEC + 1) * 1000,
+        "stream_thresholds", 1, "frozen stream was not reloaded by the watchdog");
+  check(stream.speed == 1.0 && stream.delay < MPV_MAX_DELAY_SEC, "stream_thresholds", 1, "stream did not recover after resume");
+  printf("{\"name\":\"stream_thresholds\",\"sped_up_ms\":%lld,\"slowed_down_ms\":%lld,\"reloaded_ms\":%lld,\"loads\":%d}\n",
+         (long long)sped_up_ms, (long long)slowed_down_ms, (long long)reloaded_ms, player_mock_loads(stream.player));
+
+  player_destroy(stream.player);
+}
+
+static Player *bench_create_player(int stream_i) {
+  return player_mock_new(state->streams[stream_i].name, 640, 360);
+}
+
+static int view_player_calls() {
+  int calls = 0;
+  for (int i = 0; i < state->stream_count; i++)
+    if (state->streams[i].full_player)
+      calls += player_mock_calls(state->streams[i].full_player);
+  return calls;
+}
+
+// Runs frames of the main loop on the simulated clock until until_ms.
+static int64_t view_frames(int64_t until_ms, long *frames) {
+  const int64_t tick_ms = 1000 / 60;
+  int64_t elapsed = 0;
+  while (state->now_ms + tick_ms <= until_ms) {
+    state->now_ms += tick_ms;
+    for (int i = 0; i < state->stream_count; i++) {
+      if (state->streams[i].full_player)
+        player_mock_advance(state->streams[i].full_player, state->now_ms);
+      if (state->streams[i].thumb_player)
+        player_mock_advance(state->streams[i].thumb_player, state->now_ms);
+    }
+    int64_t start = now_ns();
+    view_update(0);
+    elapsed += now_ns() - start;
+    (*frames)++;
+  }
+  return elapsed;
+}
+
+static int view_playing(int index, const char *file) {
+  const char *playing = player_mock_file(state->streams[index].full_player);
+  return file ? playing && strcmp(playing, file) == 0 : playing == NULL;
+}
+
+// The view state machine of the main loop on mock players: every transition
+// the keyboard can trigger, then a simulated minute of steady frames.
+static void bench_view(int count) {
+  state = calloc(1, sizeof(State));
+  state->width = 1920;
+  state->height = 1080;
+  state->replay_seconds = 30;
+  state->create_player = bench_create_player;
+  for (int i = 0; i < MAX_STREAMS; i++)
+    state->layout_order[i] = i;
+  state->stream_count = count;
+  char (*names)[16] = malloc(count * sizeof(*names));
+  for (int i = 0; i < count; i++) {
+    snprintf(names[i], sizeof(names[i]), "VIEW-%04d", i);
+    state->streams[i].name = names[i];
+    state->streams[i].window = i + 1;
+    state->streams[i].main = "mock://main";
+    state->streams[i].sub = "mock://sub";
+    state->streams[i].speed = 1.0;
+  }
+  int target = count / 2;
+
+  int saved_stderr = quiet_stderr();
+  view_start();
+  long frames = 0;
+  view_frames(1000, &frames);
+
+  const char *transitions[] = {"fullscreen", "next", "previous", "grid", "resize", "overlay", "overlay_off"};
+  int64_t transition_ns[7];
+  int transition_calls[7];
+  int ok[7];
+  for (int t = 0; t < 7; t++) {
+    int calls = view_player_calls();
+    int64_t start = now_ns();
+    Command command = 0;
+    switch (t) {
+    case 0:
+      command = toggle_fullscreen(state->streams[target].window);
+      break;
+    case 1:
+      command = go_next();
+      break;
+    case 2:
+      command = go_previous();
+      break;
+    case 3:
+      command = toggle_fullscreen(0);
+      break;
+    case 4:
+      command = update_size(1280, 720);
+      break;
+    case 5:
+    case 6:
+      command = toggle_overlay();
+      break;
+    }
+    view_update(command);
+    transition_ns[t] = now_ns() - start;
+    transition_calls[t] = view_player_calls() - calls;
+    view_frames(state->now_ms + 1000, &frames);
+
+    ok[t] = 1;
+    for (int i = 0; i < count; i++) {
+      switch (t) {
+      case 0:
+      case 2:
+        ok[t] &= view_playing(i, i == target ? "mock://main" : NULL);
+        break;
+      case 1:
+        ok[t] &= view_playing(i, i == (target + 1) % count ? "mock://main" : NULL);
+        break;
+      default:
+        ok[t] &= view_playing(i, count == 1 ? "mock://main" : "mock://sub");
+        break;
+      }
+    }
+  }
+
+  // Steady frames with every stream playing in the grid
+  int calls = view_player_calls();
+  long steady_frames = 0;
+  int64_t elapsed = view_frames(state->now_ms + 60 * 1000, &steady_frames);
+  int steady_calls = view_player_calls() - calls;
+
+  // Streams stopped for longer than the watchdog timeout come back without a reload
+  view_update(toggle_fullscreen(state->streams[target].window));
+  view_frames(state->now_ms + 10 * 1000, &frames);
+  view_update(toggle_fullscreen(0));
+  view_frames(state->now_ms + 10 * 1000, &frames);
+
+  // The overlay is refreshed every second on the fullscreen stream only
+  view_update(toggle_fullscreen(state->streams[target].window) | toggle_overlay());
+  calls = view_player_calls();
+  long overlay_frames = 0;
+  view_frames(state->now_ms + 10 * 1000, &overlay_frames);
+  int overlay_calls = view_player_calls() - calls;
+  view_update(toggle_overlay() | toggle_fullscreen(0));
+  restore_stderr(saved_stderr);
+
+  for (int t = 0; t < 7; t++) {
+    printf("{\"name\":\"view_transition\",\"transition\":\"%s\",\"streams\":%d,\"ns\":%lld,\"player_calls\":%d}\n",
+           transitions[t], count, (long long)transition_ns[t], transition_calls[t]);
+    check(ok[t], "view_transition", count, transitions[t]);
+  }
+  printf("{\"name\":\"view_update\",\"streams\":%d,\"iterations\":%ld,\"ns_per_op\":%.2f,\"player_calls\":%d,\"overlay_calls\":%d}\n",
+         count, steady_frames, (double)elapsed / steady_frames, steady_calls, overlay_calls);
+
+  // A resize only moves windows, the players keep playing
+  check(transition_calls[4] == 0, "view_transition", count, "resize touched the players");
+  check(steady_calls == 0, "view_update", count, "steady frames touched the players");
+  check(overlay_calls <= 11, "view_update", count, "overlay refreshed stopped streams");
+  for (int i = 0; i < count; i++) {
+    check(state->streams[i].reloads == 0, "view_update", count, "stream was reloaded");
+    player_destroy(state->streams[i].full_player);
+  }
+
+  free(names);
+  free(state);
+  state = NULL;
+}
+
+// Thumbnail panes hand over to mpv when they grow past thumb-height, which
+// happens on a resize without any view switch.
+static void bench_view_handover(int count) {
+  state = calloc(1, sizeof(State));
+  state->width = 1920;
+  state->height = 1080;
+  state->thumb_height = 360;
+  state->create_player = bench_create_player;
+  state->stream_count = count;
+  char (*names)[16] = malloc(count * sizeof(*names));
+  for (int i = 0; i < count; i++) {
+    snprintf(names[i], sizeof(names[i]), "THUMB-%04d", i);
+    state->streams[i].name = names[i];
+    state->streams[i].window = i + 1;
+    state->streams[i].main = "mock://main";
+    state->streams[i].sub = "mock://sub";
+    state->streams[i].speed = 1.0;
+    state->streams[i].thumb_player = player_mock_new(names[i], 640, 360);
+  }
+
+  int saved_stderr = quiet_stderr();
+  view_start();
+  long frames = 0;
+  view_frames(1000, &frames);
+  int small = 1;
+  for (int i = 0; i < count; i++)
+    small &= state->streams[i].player == state->streams[i].thumb_player && player_mock_file(state->streams[i].thumb_player);
+
+  view_update(update_size(3840, 2160));
+  view_frames(state->now_ms + 1000, &frames);
+  int large = 1;
+  for (int i = 0; i < count; i++)
+    large &= state->streams[i].player == state->streams[i].full_player && player_mock_file(state->streams[i].full_player) &&
+             !player_mock_file(state->streams[i].thumb_player);
+
+  view_update(update_size(1920, 1080));
+  view_frames(state->now_ms + 1000, &frames);
+  int back = 1;
+  for (int i = 0; i < count; i++)
+    back &= state->streams[i].player == state->streams[i].thumb_player &&
+            (!state->streams[i].full_player || !player_mock_file(state->streams[i].full_player));
+  restore_stderr(saved_stderr);
+
+  check(small, "view_handover", count, "small panes are not on the thumbnail player");
+  check(large, "view_handover", count, "enlarged panes kept the thumbnail player");
+  check(back, "view_handover", count, "shrunk panes kept mpv");
+
+  for (int i = 0; i < count; i++) {
+    player_destroy(state->streams[i].thumb_player);
+    if (state->streams[i].full_player)
+      player_destroy(state->streams[i].full_player);
+  }
+  free(names);
+  free(state);
+  state = NULL;
+}
+
+// Stands in for a thumbnail stream, frames of one stream are decoded in order
+// so only one task per stream may run at a time.
+typedef struct {
+  Pool *pool;
+  int queued;
+  int scheduled;
+  int active;
+  long decoded;
+  int overlaps;
+} SimulatedDecoder;
+
+static void simulated_decode(void *arg);
+
+static void simulated_schedule(SimulatedDecoder *decoder) {
+  if (!__atomic_exchange_n(&decoder->scheduled, 1, __ATOMIC_ACQ_REL))
+    pool_submit(decoder->pool, simulated_decode, decoder);
+}
+
+static void simulated_decode(void *arg) {
+  SimulatedDecoder *decoder = arg;
+  if (__atomic_exchange_n(&decoder->active, 1, __ATOMIC_ACQ_REL))
+    decoder->overlaps++;
+
+  // A few frames per run so one stream can not starve the others
+  for (int i = 0; i < 4 && __atomic_load_n(&decoder->queued, __ATOMIC_ACQUIRE) > 0; i++) {
+    __atomic_sub_fetch(&decoder->queued, 1, __ATOMIC_ACQ_REL);
+    for (volatile int work = 0; work < 2000; work++)
+      ;
+    decoder->decoded++;
+  }
+
+  __atomic_store_n(&decoder->active, 0, __ATOMIC_RELEASE);
+  __atomic_store_n(&decoder->scheduled, 0, __ATOMIC_SEQ_CST);
+  if (__atomic_load_n(&decoder->queued, __ATOMIC_SEQ_CST) > 0)
+    simulated_schedule(decoder);
+}
+
+static void bench_pool(int threads, int streams) {
+  const int frames = 200;
+  Pool *pool = pool_new(threads);
+  SimulatedDecoder *decoders = calloc(streams, sizeof(SimulatedDecoder));
+  for (int i = 0; i < streams; i++)
+    decoders[i].pool = pool;
+
+  int64_t start = now_ns();
+  for (int frame = 0; frame < frames; frame++)
+    for (int i = 0; i < streams; i++) {
+      __atomic_add_fetch(&decoders[i].queued, 1, __ATOMIC_SEQ_CST);
+      simulated_schedule(&decoders[i]);
+    }
+  pool_wait(pool);
+  int64_t elapsed = now_ns() - start;
+
+  long decoded = 0;
+  for (int i = 0; i < streams; i++) {
+    decoded += decoders[i].decoded;
+    check(decoders[i].overlaps == 0, "pool", threads, "stream decoded on two threads at once");
+  }
+  check(decoded == (long)streams * frames, "pool", threads, "frames were lost");
+
+  printf("{\"name\":\"pool\",\"threads\":%d,\"streams\":%d,\"iterations\":%ld,\"ns_per_op\":%.2f,\"steals\":%ld}\n",
+         pool_thread_count(pool), streams, decoded, (double)elapsed / decoded, pool_steals(pool));
+
+  pool_free(pool);
+  free(decoders);
+}
+
+// A leader and its followers on one machine, the same setup as several
+// instances sharing a config with cluster-interface = 127.0.0.1.
+static void bench_cluster(int followers) {
+  char group[32];
+  snprintf(group, sizeof(group), "239.255.0.42:%d", 20000 + getpid() % 20000);
+
+  Cluster leader;
+  Cluster nodes[8];
+  if (cluster_open(&leader, CLUSTER_LEADER, group, "127.0.0.1") < 0) {
+    fprintf(stderr, "cluster: multicast on loopback is not available, skipped\n");
+    return;
+  }
+  for (int i = 0; i < followers; i++)
+    if (cluster_open(&nodes[i], CLUSTER_FOLLOWER, group, "127.0.0.1") < 0) {
+      fprintf(stderr, "cluster: multicast on loopback is not available, skipped\n");
+      cluster_close(&leader);
+      for (int j = 0; j < i; j++)
+        cluster_close(&nodes[j]);
+      return;
+    }
+
+  const int updates = 1000;
+  const int cameras = 32;
+  long applied = 0;
+  int64_t worst = 0;
+  ClusterState state = {.view = CLUSTER_VIEW_DEFAULT, .fullscreen = -1, .camera_count = cameras};
+  int64_t start = now_ns();
+  for (int update = 0; update < updates; update++) {
+    state.view = update % 3 ? CLUSTER_VIEW_FULLSCREEN : CLUSTER_VIEW_DEFAULT;
+    state.fullscreen = update % cameras;
+    state.layout_generation = update / 100;
+    int64_t sent = now_ns();
+    cluster_publish(&leader, &state, 0);
+
+    for (int i = 0; i < followers; i++) {
+      // Followers poll once per frame, a message not there within one frame was applied late
+      ClusterState received = {0};
+      int got = 0;
+      while (!got && now_ns() - sent < 16000000)
+        got = cluster_receive(&nodes[i], &received);
+      check(got, "cluster", followers, "follower did not receive an update within a frame");
+      check(received.sequence == state.sequence && received.view == state.view && received.fullscreen == state.fullscreen &&
+                received.layout_generation == state.layout_generation,
+            "cluster", followers, "follower state differs from leader");
+      applied += got;
+      worst = MAX(worst, now_ns() - sent);
+    }
+  }
+  int64_t elapsed = now_ns() - start;
+
+  // Heartbeats repeat the last state and must not be applied again
+  ClusterState received;
+  cluster_heartbeat(&leader, &state, 1000000);
+  usleep(1000);
+  for (int i = 0; i < followers; i++) {
+    check(!cluster_receive(&nodes[i], &received), "cluster", followers, "heartbeat was applied as an update");
+    check(nodes[i].missed == 0, "cluster", followers, "updates were missed on loopback");
+  }
+
+  printf("{\"name\":\"cluster\",\"followers\":%d,\"iterations\":%ld,\"ns_per_op\":%.2f,\"worst_ns\":%ld}\n",
+         followers, applied, applied ? (double)elapsed / applied : 0, (long)worst);
+
+  cluster_close(&leader);
+  for (int i = 0; i < followers; i++)
+    cluster_close(&nodes[i]);
+}
+
+// Limits stay within the budget whenever the reserved parts leave room for the floor.
+static void bench_memory_assign() {
+  MemoryRole roles[MAX_STREAMS];
+  int64_t back_bytes[MAX_STREAMS] = {};
+  MemoryLimits limits[MAX_STREAMS];
+  for (int budget_mib = 64; budget_mib <= 4096; budget_mib *= 2)
+    for (int count = 1; count <= MAX_STREAMS; count++) {
+      for (int i = 0; i < count; i++)
+        roles[i] = i == 0 ? MEMORY_ROLE_FULLSCREEN : i % 3 ? MEMORY_ROLE_PANE : MEMORY_ROLE_STANDBY;
+      int64_t budget = (int64_t)budget_mib * 1024 * 1024;
+      int64_t over = memory_assign(budget, roles, back_bytes, count, limits);
+
+      int64_t total = 0;
+      for (int i = 0; i < count; i++) {
+        total += limits[i].max_bytes + limits[i].max_back_bytes;
+        check(limits[i].max_bytes >= 256 * 1024, "memory_assign", budget_mib, "demuxer cache below the floor");
+      }
+      check(over == MAX(total - budget, 0), "memory_assign", budget_mib, "overrun not reported");
+      if (budget_mib >= 1024)
+        check(over == 0, "memory_assign", budget_mib, "limits exceed a budget that fits");
+    }
+}
+
+static void bench_cluster_assign() {
+  for (int cameras = 0; cameras <= MAX_STREAMS; cameras++)
+    for (int node_count = 1; node_count <= 8; node_count++) {
+      int next = 0;
+      for (int node = 0; node < node_count; node++) {
+        int first, count;
+        cluster_assign(cameras, node_count, node, &first, &count);
+        check(first == next && count >= cameras / node_count && count <= cameras / node_count + 1,
+              "cluster_assign", cameras, "cameras are not split evenly");
+        next = first + count;
+      }
+      check(next == cameras, "cluster_assign", cameras, "not every camera has a node");
+    }
+}
+
+// Cost of one event on the calling thread, compiled out unless built with TRACE=1.
+static void bench_trace() {
+  const long iterations = 10000000;
+  int64_t start = now_ns();
+  for (long i = 0; i < iterations; i += 2) {
+    TRACE_BEGIN("bench", "stream");
+    TRACE_END();
+  }
+  report("trace_event", "enabled",
+#ifdef TRACE
+         1,
+#else
+         0,
+#endif
+         iterations, now_ns() - start);
+
+#ifdef TRACE
+  char path[] = "/tmp/camviewport-bench-XXXXXX";
+  int fd = mkstemp(path);
+  check(fd >= 0 && trace_dump(path) == 0, "trace_dump", 1, "failed to write trace");
+  if (fd >= 0) {
+    close(fd);
+    unlink(path);
+  }
+#endif
+}
+
+int main() {
+  int panes[] = {1, 2, 3, 4, 5, 6, 9, 16, 25, 32, 64, 100, 256, 500, 1000};
+  for (int i = 0; i < sizeof(panes) / sizeof(panes[0]); i++)
+    bench_layout_grid(panes[i]);
+
+  int solve_panes[] = {1, 2, 3, 4, 5, 6, 9, 16, 25, 32};
+  for (int i = 0; i < sizeof(solve_panes) / sizeof(solve_panes[0]); i++) {
+    bench_layout_solve(1920, 1080, solve_panes[i]);
+    bench_layout_solve(1080, 1920, solve_panes[i]);
+  }
+
+  int lines[] = {100, 1000, 10000, 100000};
+  for (int i = 0; i < sizeof(lines) / sizeof(lines[0]); i++)
+    bench_layout_file(lines[i]);
+
+  int flags[] = {0, 8, 32, MAX_MPV_FLAGS};
+  for (int i = 0; i < sizeof(flags) / sizeof(flags[0]); i++)
+    bench_config_file(flags[i]);
+
+  int streams[] = {1, 32, 1000};
+  for (int i = 0; i < sizeof(streams) / sizeof(streams[0]); i++)
+    bench_streams(streams[i]);
+  bench_stream_thresholds();
+
+  int views[] = {1, 16, MAX_STREAMS};
+  for (int i = 0; i < sizeof(views) / sizeof(views[0]); i++)
+    bench_view(views[i]);
+  bench_view_handover(16);
+
+  int threads[] = {1, 2, 4, 8};
+  for (int i = 0; i < sizeof(threads) / sizeof(threads[0]); i++)
+    bench_pool(threads[i], 100);
+
+  int cameras[] = {1, 16, 100};
+  fake_mpv_init();
+  for (int i = 0; i < sizeof(cameras) / sizeof(cameras[0]); i++) {
+    bench_activity(cameras[i]);
+    bench_activity_capture(cameras[i], 0);
+    bench_activity_capture(cameras[i], 4);
+  }
+
+  bench_trace();
+
+  bench_memory_assign();
+  bench_cluster_assign();
+  int followers[] = {1, 3, 7};
+  for (int i = 0; i < sizeof(followers) / sizeof(followers[0]); i++)
+    bench_cluster(followers[i]);
+
+  if (failures) {
+    fprintf(stderr, "%d checks failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
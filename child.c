@@ -0,0 +1,551 @@
+#include "child.h"
+#include "activity.h"
+#include "main.h"
+#include "player.h"
+#include "util.h"
+#include <errno.h>
+#include <poll.h>
+#include <signal.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/prctl.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CHILD_MESSAGE_DATA 2048
+
+typedef enum {
+  // Parent to child
+  CHILD_MESSAGE_COMMAND,
+  CHILD_MESSAGE_SET_PROPERTY,
+  // Child to parent
+  CHILD_MESSAGE_EVENT,
+  CHILD_MESSAGE_PROPERTY,
+  CHILD_MESSAGE_LOG,
+  CHILD_MESSAGE_THUMBNAIL,
+} ChildMessageType;
+
+// Every message is a single packet, strings in data are NUL separated.
+typedef struct {
+  uint8_t type;
+  uint8_t format;
+  uint16_t size;
+  uint32_t event_id;
+  union {
+    double double_;
+    int64_t int64;
+  } value;
+  char data[CHILD_MESSAGE_DATA];
+} ChildMessage;
+
+// Sent to the spawner, answered with the pid and the socket of the player
+typedef struct {
+  int index;
+  char name[64];
+} SpawnRequest;
+
+typedef struct {
+  pid_t pid;
+  char name[64];
+} Spawned;
+
+const static int CHILD_MAX_BACKOFF_SEC = 30;
+const static int CHILD_STABLE_SEC = 60;
+// Players that died may not be reaped yet when their restart is spawned
+#define SPAWNER_MAX_CHILDREN (MAX_STREAMS * 2)
+
+static ChildCreate spawner_create;
+static pid_t spawner_pid;
+static int spawner_fd = -1;
+
+static int time_now() { return (int)time(NULL); }
+
+static int64_t time_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static int send_message(int fd, ChildMessage *message) {
+  if (fd < 0)
+    return -1;
+  size_t length = offsetof(ChildMessage, data) + message->size;
+  return send(fd, message, length, MSG_NOSIGNAL) == length ? 0 : -1;
+}
+
+// Packs strings into data, returns -1 when they do not fit.
+static int pack_strings(ChildMessage *message, const char **strings) {
+  message->size = 0;
+  for (int i = 0; strings[i]; i++) {
+    size_t length = strlen(strings[i]) + 1;
+    if (message->size + length > CHILD_MESSAGE_DATA)
+      return -1;
+    memcpy(&message->data[message->size], strings[i], length);
+    message->size += length;
+  }
+  return 0;
+}
+
+// Unpacks strings from data into a NULL terminated array.
+static void unpack_strings(ChildMessage *message, const char **strings, int max) {
+  int count = 0;
+  for (int offset = 0; offset < message->size && count < max - 1; offset += strlen(&message->data[offset]) + 1)
+    strings[count++] = &message->data[offset];
+  strings[count] = NULL;
+}
+
+static void forward_event(int fd, mpv_event *event) {
+  ChildMessage message = {};
+
+  switch (event->event_id) {
+  case MPV_EVENT_LOG_MESSAGE: {
+    mpv_event_log_message *log = event->data;
+    message.type = CHILD_MESSAGE_LOG;
+    const char *strings[] = {log->text, NULL};
+    if (pack_strings(&message, strings) < 0)
+      return;
+    break;
+  }
+  case MPV_EVENT_PROPERTY_CHANGE: {
+    mpv_event_property *property = event->data;
+    message.type = CHILD_MESSAGE_PROPERTY;
+    message.format = MPV_FORMAT_NONE;
+    if (property->data && property->format == MPV_FORMAT_DOUBLE) {
+      message.format = MPV_FORMAT_DOUBLE;
+      message.value.double_ = *(double *)property->data;
+    } else if (property->data && property->format == MPV_FORMAT_INT64) {
+      message.format = MPV_FORMAT_INT64;
+      message.value.int64 = *(int64_t *)property->data;
+    } else if (property->data && property->format == MPV_FORMAT_NODE) {
+      // Only the byte count of demuxer-cache-state is used by the parent
+      mpv_node *node = property->data;
+      if (node->format == MPV_FORMAT_NODE_MAP)
+        for (int i = 0; i < node->u.list->num; i++)
+          if (strcmp(node->u.list->keys[i], "total-bytes") == 0) {
+            message.format = MPV_FORMAT_NODE;
+            message.value.int64 = node->u.list->values[i].u.int64;
+          }
+    }
+    const char *strings[] = {property->name, NULL};
+    if (pack_strings(&message, strings) < 0)
+      return;
+    break;
+  }
+  case MPV_EVENT_COMMAND_REPLY: {
+    // Screenshots are shrunk here so only the thumbnail crosses the socket
+    mpv_event_command *command = event->data;
+    message.type = CHILD_MESSAGE_THUMBNAIL;
+    message.size = ACTIVITY_THUMB_SIZE;
+    if (event->error < 0 || activity_thumbnail_node(&command->result, (uint8_t *)message.data) < 0)
+      return;
+    break;
+  }
+  case MPV_EVENT_FILE_LOADED:
+  case MPV_EVENT_PLAYBACK_RESTART:
+  case MPV_EVENT_END_FILE:
+    message.type = CHILD_MESSAGE_EVENT;
+    message.event_id = event->event_id;
+    break;
+  default:
+    return;
+  }
+
+  send_message(fd, &message);
+}
+
+static void handle_message(mpv_handle *mpv, ChildMessage *message) {
+  const char *strings[64];
+  unpack_strings(message, strings, sizeof(strings) / sizeof(strings[0]));
+
+  switch (message->type) {
+  case CHILD_MESSAGE_COMMAND:
+    // Commands are async so a slow loadfile can not hold up property changes
+    mpv_command_async(mpv, 0, strings);
+    break;
+  case CHILD_MESSAGE_SET_PROPERTY:
+    if (strings[0] && strings[1])
+      mpv_set_property_string(mpv, strings[0], strings[1]);
+    break;
+  }
+}
+
+static void child_main(int index, int fd, pid_t parent) {
+  // Die with the spawner, which dies with camviewport
+  prctl(PR_SET_PDEATHSIG, SIGKILL);
+  if (getppid() != parent)
+    _exit(1);
+
+  mpv_handle *mpv = spawner_create(index);
+
+  struct pollfd fds[] = {
+      {.fd = fd, .events = POLLIN},
+      {.fd = mpv_get_wakeup_pipe(mpv), .events = POLLIN},
+  };
+
+  while (1) {
+    if (poll(fds, 2, -1) < 0 && errno != EINTR)
+      break;
+
+    if (fds[0].revents & (POLLERR | POLLHUP))
+      break;
+    if (fds[0].revents & POLLIN) {
+      ChildMessage message;
+      ssize_t length = recv(fd, &message, sizeof(message), 0);
+      if (length <= 0)
+        break;
+      handle_message(mpv, &message);
+    }
+
+    if (fds[1].revents & POLLIN) {
+      char buffer[64];
+      while (read(fds[1].fd, buffer, sizeof(buffer)) == sizeof(buffer)) {
+      }
+
+      while (1) {
+        mpv_event *event = mpv_wait_event(mpv, 0);
+        if (event->event_id == MPV_EVENT_NONE)
+          break;
+        if (event->event_id == MPV_EVENT_SHUTDOWN)
+          goto end;
+        forward_event(fd, event);
+      }
+    }
+  }
+
+end:
+  mpv_terminate_destroy(mpv);
+  _exit(0);
+}
+
+static int send_spawned(int fd, pid_t pid, int child_fd) {
+  struct iovec iov = {.iov_base = &pid, .iov_len = sizeof(pid)};
+  union {
+    char buffer[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control = {};
+  struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1};
+  if (child_fd >= 0) {
+    message.msg_control = control.buffer;
+    message.msg_controllen = sizeof(control.buffer);
+    struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+    header->cmsg_level = SOL_SOCKET;
+    header->cmsg_type = SCM_RIGHTS;
+    header->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(header), &child_fd, sizeof(int));
+  }
+  return sendmsg(fd, &message, MSG_NOSIGNAL) == sizeof(pid) ? 0 : -1;
+}
+
+// Reaps exited players, waiting for all of them when shutting down.
+static void reap(Spawned *spawned, int shutdown) {
+  int status = 0;
+  pid_t pid;
+  while ((pid = waitpid(-1, &status, shutdown ? 0 : WNOHANG)) > 0) {
+    for (int i = 0; i < SPAWNER_MAX_CHILDREN; i++) {
+      if (spawned[i].pid != pid)
+        continue;
+      spawned[i].pid = 0;
+      if (shutdown)
+        break;
+      if (WIFSIGNALED(status))
+        fprintf(stderr, "%s: player process killed by signal %d\n", spawned[i].name, WTERMSIG(status));
+      else
+        fprintf(stderr, "%s: player process exited with status %d\n", spawned[i].name, WEXITSTATUS(status));
+      break;
+    }
+  }
+}
+
+// Single threaded, so every fork happens without locks held by other threads.
+static void spawner_main(int fd) {
+  Spawned spawned[SPAWNER_MAX_CHILDREN] = {};
+  struct pollfd poll_fd = {.fd = fd, .events = POLLIN};
+
+  while (1) {
+    reap(spawned, 0);
+    // Wakes up every second to reap players that died in the meantime
+    if (poll(&poll_fd, 1, 1000) < 0 && errno != EINTR)
+      break;
+    if (!(poll_fd.revents & (POLLIN | POLLHUP | POLLERR)))
+      continue;
+
+    // camviewport closes the socket when it shuts down
+    SpawnRequest request;
+    if (recv(fd, &request, sizeof(request), 0) != sizeof(request))
+      break;
+    request.name[sizeof(request.name) - 1] = 0;
+
+    int fds[2];
+    pid_t pid = -1;
+    if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) == 0) {
+      pid_t parent = getpid();
+      pid = fork();
+      if (pid == 0) {
+        close(fd);
+        close(fds[0]);
+        child_main(request.index, fds[1], parent);
+      }
+      close(fds[1]);
+      if (pid < 0)
+        close(fds[0]);
+    }
+
+    if (pid > 0)
+      for (int i = 0; i < SPAWNER_MAX_CHILDREN; i++)
+        if (spawned[i].pid == 0) {
+          spawned[i].pid = pid;
+          memcpy(spawned[i].name, request.name, sizeof(request.name));
+          break;
+        }
+    send_spawned(fd, pid, pid > 0 ? fds[0] : -1);
+    if (pid > 0)
+      close(fds[0]);
+  }
+
+  reap(spawned, 1);
+  _exit(0);
+}
+
+void child_spawner_start(ChildCreate create) {
+  int fds[2];
+  if (socketpair(AF_UNIX, SOCK_SEQPACKET, 0, fds) < 0)
+    die("failed to start player spawner");
+
+  spawner_create = create;
+  pid_t parent = getpid();
+  spawner_pid = fork();
+  if (spawner_pid < 0)
+    die("failed to start player spawner");
+  if (spawner_pid == 0) {
+    close(fds[0]);
+    prctl(PR_SET_PDEATHSIG, SIGKILL);
+    if (getppid() != parent)
+      _exit(1);
+    spawner_main(fds[1]);
+  }
+
+  close(fds[1]);
+  spawner_fd = fds[0];
+}
+
+void child_spawner_stop() {
+  if (spawner_fd < 0)
+    return;
+  close(spawner_fd);
+  spawner_fd = -1;
+  waitpid(spawner_pid, NULL, 0);
+}
+
+static int spawn(Child *child) {
+  SpawnRequest request = {.index = child->index};
+  snprintf(request.name, sizeof(request.name), "%s", child->name);
+  if (spawner_fd < 0 || send(spawner_fd, &request, sizeof(request), MSG_NOSIGNAL) != sizeof(request))
+    return -1;
+
+  pid_t pid = -1;
+  struct iovec iov = {.iov_base = &pid, .iov_len = sizeof(pid)};
+  union {
+    char buffer[CMSG_SPACE(sizeof(int))];
+    struct cmsghdr align;
+  } control = {};
+  struct msghdr message = {.msg_iov = &iov, .msg_iovlen = 1, .msg_control = control.buffer, .msg_controllen = sizeof(control.buffer)};
+  if (recvmsg(spawner_fd, &message, 0) != sizeof(pid) || pid < 0)
+    return -1;
+  struct cmsghdr *header = CMSG_FIRSTHDR(&message);
+  if (header == NULL || header->cmsg_level != SOL_SOCKET || header->cmsg_type != SCM_RIGHTS)
+    return -1;
+
+  memcpy(&child->fd, CMSG_DATA(header), sizeof(int));
+  child->pid = pid;
+  child->spawned_at_ms = time_now_ms();
+  return 0;
+}
+
+Child *child_spawn(const char *name, int index) {
+  Child *child = calloc(1, sizeof(Child));
+  child->name = name;
+  child->index = index;
+  child->fd = -1;
+  child->backoff_sec = 1;
+
+  if (spawn(child) < 0)
+    die("failed to spawn player process");
+  return child;
+}
+
+int child_alive(Child *child) { return child->fd >= 0; }
+
+// The spawner reaps the process and logs how it exited.
+static void on_death(Child *child) {
+  close(child->fd);
+  child->fd = -1;
+  child->pid = 0;
+
+  // Only back off when the child keeps dying shortly after starting
+  if (time_now_ms() - child->spawned_at_ms > CHILD_STABLE_SEC * 1000)
+    child->backoff_sec = 1;
+  child->restart_at = time_now() + child->backoff_sec;
+  fprintf(stderr, "%s: restarting player process in %d seconds\n", child->name, child->backoff_sec);
+  child->backoff_sec = MIN(child->backoff_sec * 2, CHILD_MAX_BACKOFF_SEC);
+}
+
+int child_supervise(Child *child) {
+  if (child_alive(child) || time_now() < child->restart_at)
+    return 0;
+
+  if (spawn(child) < 0) {
+    child->restart_at = time_now() + child->backoff_sec;
+    return 0;
+  }
+  child->restarts++;
+  child->restarting = 1;
+  return 1;
+}
+
+int child_command(Child *child, const char **args) {
+  ChildMessage message = {.type = CHILD_MESSAGE_COMMAND};
+  if (pack_strings(&message, args) < 0)
+    return -1;
+  return send_message(child->fd, &message);
+}
+
+int child_set_property_string(Child *child, const char *name, const char *data) {
+  ChildMessage message = {.type = CHILD_MESSAGE_SET_PROPERTY};
+  const char *strings[] = {name, data, NULL};
+  if (pack_strings(&message, strings) < 0)
+    return -1;
+  return send_message(child->fd, &message);
+}
+
+mpv_event *child_wait_event(Child *child) {
+  // Storage for the returned event, valid until the next call like mpv_wait_event
+  static mpv_event event;
+  static mpv_event_property property;
+  static mpv_event_log_message log;
+  static ChildMessage message;
+  static double double_;
+  static int64_t int64;
+  static mpv_node node, node_value;
+  static mpv_node_list node_list;
+  static char *node_keys[] = {"total-bytes"};
+  static mpv_event_command command;
+  static mpv_node thumb_values[5];
+  static mpv_node_list thumb_list;
+  static mpv_byte_array thumb_data;
+  static char *thumb_keys[] = {"w", "h", "stride", "format", "data"};
+
+  memset(&event, 0, sizeof(event));
+  event.event_id = MPV_EVENT_NONE;
+  if (!child_alive(child))
+    return &event;
+
+  ssize_t length = recv(child->fd, &message, sizeof(message), MSG_DONTWAIT);
+  if (length < 0 && (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR))
+    return &event;
+  if (length <= 0) {
+    on_death(child);
+    return &event;
+  }
+  if (message.size >= CHILD_MESSAGE_DATA)
+    message.size = CHILD_MESSAGE_DATA - 1;
+  message.data[message.size] = 0;
+
+  switch (message.type) {
+  case CHILD_MESSAGE_LOG:
+    log.text = message.data;
+    event.event_id = MPV_EVENT_LOG_MESSAGE;
+    event.data = &log;
+    break;
+  case CHILD_MESSAGE_PROPERTY:
+    property.name = message.data;
+    property.format = message.format;
+    property.data = NULL;
+    if (message.format == MPV_FORMAT_DOUBLE) {
+      double_ = message.value.double_;
+      property.data = &double_;
+    } else if (message.format == MPV_FORMAT_INT64) {
+      int64 = message.value.int64;
+      property.data = &int64;
+    } else if (message.format == MPV_FORMAT_NODE) {
+      node_value.format = MPV_FORMAT_INT64;
+      node_value.u.int64 = message.value.int64;
+      node_list.num = 1;
+      node_list.keys = node_keys;
+      node_list.values = &node_value;
+      node.format = MPV_FORMAT_NODE_MAP;
+      node.u.list = &node_list;
+      property.data = &node;
+    }
+    event.event_id = MPV_EVENT_PROPERTY_CHANGE;
+    event.data = &property;
+    break;
+  case CHILD_MESSAGE_THUMBNAIL:
+    if (message.size < ACTIVITY_THUMB_SIZE)
+      break;
+    thumb_data.data = message.data;
+    thumb_data.size = ACTIVITY_THUMB_SIZE;
+    thumb_values[0] = (mpv_node){.format = MPV_FORMAT_INT64, .u.int64 = ACTIVITY_THUMB_WIDTH};
+    thumb_values[1] = (mpv_node){.format = MPV_FORMAT_INT64, .u.int64 = ACTIVITY_THUMB_HEIGHT};
+    thumb_values[2] = (mpv_node){.format = MPV_FORMAT_INT64, .u.int64 = ACTIVITY_THUMB_WIDTH};
+    thumb_values[3] = (mpv_node){.format = MPV_FORMAT_STRING, .u.string = "y8"};
+    thumb_values[4] = (mpv_node){.format = MPV_FORMAT_BYTE_ARRAY, .u.ba = &thumb_data};
+    thumb_list.num = 5;
+    thumb_list.keys = thumb_keys;
+    thumb_list.values = thumb_values;
+    command.result.format = MPV_FORMAT_NODE_MAP;
+    command.result.u.list = &thumb_list;
+    event.event_id = MPV_EVENT_COMMAND_REPLY;
+    event.data = &command;
+    break;
+  case CHILD_MESSAGE_EVENT:
+    event.event_id = message.event_id;
+    if (event.event_id == MPV_EVENT_PLAYBACK_RESTART && child->restarting) {
+      child->restarting = 0;
+      fprintf(stderr, "%s: player process restarted in %lld ms (restart %d)\n", child->name,
+              (long long)(time_now_ms() - child->spawned_at_ms), child->restarts);
+    }
+    break;
+  }
+
+  return &event;
+}
+
+void child_close(Child *child) {
+  if (child_alive(child))
+    close(child->fd);
+  child->fd = -1;
+}
+
+static int child_player_command(Player *player, const char **args) {
+  return child_command(player->handle, args);
+}
+
+static int child_player_set_property_string(Player *player, const char *name, const char *data) {
+  return child_set_property_string(player->handle, name, data);
+}
+
+static mpv_event *child_player_wait_event(Player *player) {
+  return child_wait_event(player->handle);
+}
+
+// The process exits once its socket is closed, child_spawner_stop waits for it.
+static void child_player_destroy(Player *player) {
+  child_close(player->handle);
+}
+
+// Commands always run asynchronously in the child.
+static const PlayerBackend child_backend = {
+    .command = child_player_command,
+    .command_async = child_player_command,
+    .set_property_string = child_player_set_property_string,
+    .wait_event = child_player_wait_event,
+    .destroy = child_player_destroy,
+};
+
+Player *player_child_new(const char *name, Child *child) {
+  return player_new(&child_backend, name, child);
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#include <mpv/client.h>
+#include <stdint.h>
+#include <sys/types.h>
+
+// Creates and initializes the player, called inside the child process.
+typedef mpv_handle *(*ChildCreate)(int index);
+
+typedef struct Child {
+  const char *name;
+  int index;
+
+  // Not a child of this process, the spawner reaps it
+  pid_t pid;
+  int fd;
+  int64_t spawned_at_ms;
+  int restarting;
+  int restarts;
+  int backoff_sec;
+  int restart_at;
+} Child;
+
+// Forks the process that spawns and reaps every player process. Must run
+// before any thread is started, the players are forked from its copy of
+// this process.
+void child_spawner_start(ChildCreate create);
+
+// Waits for every player process to exit, once their sockets are closed.
+void child_spawner_stop();
+
+Child *child_spawn(const char *name, int index);
+
+int child_alive(Child *child);
+
+// Returns 1 when a dead child was restarted and needs its file loaded again.
+int child_supervise(Child *child);
+
+int child_command(Child *child, const char **args);
+
+int child_set_property_string(Child *child, const char *name, const char *data);
+
+// Same contract as mpv_wait_event with a timeout of 0.
+mpv_event *child_wait_event(Child *child);
+
+void child_close(Child *child);
@@ -0,0 +1,177 @@
+#include "cluster.h"
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#define CLUSTER_MAGIC 0x43565731 // CVW1
+#define CLUSTER_MESSAGE_SIZE 24
+#define CLUSTER_HEARTBEAT_MS 1000
+
+ClusterRole cluster_role(const char *name) {
+  if (!name)
+    return CLUSTER_NONE;
+  if (strcmp(name, "leader") == 0)
+    return CLUSTER_LEADER;
+  if (strcmp(name, "follower") == 0)
+    return CLUSTER_FOLLOWER;
+  return CLUSTER_NONE;
+}
+
+static int parse_group(const char *group, struct sockaddr_in *addr) {
+  char host[64];
+  const char *colon = strrchr(group, ':');
+  if (!colon || colon - group >= sizeof(host))
+    return -1;
+  memcpy(host, group, colon - group);
+  host[colon - group] = 0;
+
+  memset(addr, 0, sizeof(*addr));
+  addr->sin_family = AF_INET;
+  addr->sin_port = htons(atoi(colon + 1));
+  if (inet_pton(AF_INET, host, &addr->sin_addr) != 1 || !IN_MULTICAST(ntohl(addr->sin_addr.s_addr)))
+    return -1;
+  return 0;
+}
+
+int cluster_open(Cluster *cluster, ClusterRole role, const char *group, const char *interface) {
+  memset(cluster, 0, sizeof(*cluster));
+  cluster->role = role;
+  cluster->fd = -1;
+  if (parse_group(group, &cluster->group) < 0) {
+    fprintf(stderr, "cluster: invalid multicast group '%s'\n", group);
+    return -1;
+  }
+
+  struct in_addr local = {.s_addr = htonl(INADDR_ANY)};
+  if (interface && inet_pton(AF_INET, interface, &local) != 1) {
+    fprintf(stderr, "cluster: invalid interface '%s'\n", interface);
+    return -1;
+  }
+
+  int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+  if (fd < 0)
+    return -1;
+
+  // Several nodes on one machine share the port
+  int yes = 1;
+  setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &yes, sizeof(yes));
+  setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &yes, sizeof(yes));
+
+  if (role == CLUSTER_LEADER) {
+    unsigned char loop = 1;
+    unsigned char ttl = 1;
+    if (setsockopt(fd, IPPROTO_IP, IP_MULTICAST_IF, &local, sizeof(local)) < 0 ||
+        setsockopt(fd, IPPROTO_IP, IP_MULTICAST_LOOP, &loop, sizeof(loop)) < 0 ||
+        setsockopt(fd, IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl)) < 0)
+      goto fail;
+    // Restarted leaders are told apart by their epoch, so followers accept their lower sequence numbers
+    cluster->epoch = (uint32_t)time(NULL) ^ ((uint32_t)getpid() << 16);
+  } else {
+    struct sockaddr_in bind_addr = {.sin_family = AF_INET, .sin_port = cluster->group.sin_port, .sin_addr = cluster->group.sin_addr};
+    struct ip_mreq membership = {.imr_multiaddr = cluster->group.sin_addr, .imr_interface = local};
+    if (bind(fd, (struct sockaddr *)&bind_addr, sizeof(bind_addr)) < 0 ||
+        setsockopt(fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &membership, sizeof(membership)) < 0)
+      goto fail;
+  }
+
+  cluster->fd = fd;
+  return 0;
+
+fail:
+  fprintf(stderr, "cluster: failed to join %s: %s\n", group, strerror(errno));
+  close(fd);
+  return -1;
+}
+
+static void put32(uint8_t *p, uint32_t value) {
+  value = htonl(value);
+  memcpy(p, &value, 4);
+}
+
+static uint32_t get32(const uint8_t *p) {
+  uint32_t value;
+  memcpy(&value, p, 4);
+  return ntohl(value);
+}
+
+static int send_state(Cluster *cluster, const ClusterState *state, int64_t now_ms) {
+  uint8_t message[CLUSTER_MESSAGE_SIZE];
+  put32(message, CLUSTER_MAGIC);
+  put32(message + 4, cluster->epoch);
+  put32(message + 8, state->sequence);
+  put32(message + 12, state->view);
+  put32(message + 16, (uint32_t)state->fullscreen);
+  put32(message + 20, ((uint32_t)state->layout_generation << 16) | (state->camera_count & 0xffff));
+
+  cluster->sent_at_ms = now_ms;
+  if (sendto(cluster->fd, message, sizeof(message), 0, (struct sockaddr *)&cluster->group, sizeof(cluster->group)) < 0) {
+    fprintf(stderr, "cluster: failed to send state %u: %s\n", state->sequence, strerror(errno));
+    return -1;
+  }
+  return 0;
+}
+
+int cluster_publish(Cluster *cluster, ClusterState *state, int64_t now_ms) {
+  state->sequence = ++cluster->sequence;
+  return send_state(cluster, state, now_ms);
+}
+
+void cluster_heartbeat(Cluster *cluster, const ClusterState *state, int64_t now_ms) {
+  if (now_ms >= cluster->sent_at_ms + CLUSTER_HEARTBEAT_MS)
+    send_state(cluster, state, now_ms);
+}
+
+int cluster_receive(Cluster *cluster, ClusterState *state) {
+  int updated = 0;
+  uint8_t message[CLUSTER_MESSAGE_SIZE];
+
+  while (1) {
+    ssize_t size = recv(cluster->fd, message, sizeof(message), 0);
+    if (size < 0)
+      break;
+    if (size != CLUSTER_MESSAGE_SIZE || get32(message) != CLUSTER_MAGIC)
+      continue;
+
+    uint32_t epoch = get32(message + 4);
+    uint32_t sequence = get32(message + 8);
+    if (cluster->synced && epoch == cluster->epoch) {
+      // Heartbeats repeat the last sequence, anything older arrived out of order
+      if ((int32_t)(sequence - cluster->sequence) <= 0)
+        continue;
+      if (sequence != cluster->sequence + 1) {
+        fprintf(stderr, "cluster: missed %u updates\n", sequence - cluster->sequence - 1);
+        cluster->missed += sequence - cluster->sequence - 1;
+      }
+    } else if (cluster->synced) {
+      fprintf(stderr, "cluster: leader restarted\n");
+    }
+
+    cluster->synced = 1;
+    cluster->epoch = epoch;
+    cluster->sequence = sequence;
+    state->sequence = sequence;
+    state->view = get32(message + 12);
+    state->fullscreen = (int32_t)get32(message + 16);
+    state->layout_generation = get32(message + 20) >> 16;
+    state->camera_count = get32(message + 20) & 0xffff;
+    updated = 1;
+  }
+
+  return updated;
+}
+
+void cluster_assign(int camera_count, int node_count, int node, int *first, int *count) {
+  *first = camera_count * node / node_count;
+  *count = camera_count * (node + 1) / node_count - *first;
+}
+
+void cluster_close(Cluster *cluster) {
+  if (cluster->fd >= 0)
+    close(cluster->fd);
+  cluster->fd = -1;
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <netinet/in.h>
+#include <stdint.h>
+
+// Keeps the views of several camviewport instances in step over UDP
+// multicast. The leader sends the whole wall state on every change and
+// repeats it as a heartbeat, followers apply the newest one they receive.
+
+typedef enum {
+  CLUSTER_NONE,
+  CLUSTER_LEADER,
+  CLUSTER_FOLLOWER,
+} ClusterRole;
+
+typedef enum {
+  CLUSTER_VIEW_DEFAULT,
+  CLUSTER_VIEW_FULLSCREEN,
+} ClusterView;
+
+typedef struct {
+  uint32_t sequence;
+  ClusterView view;
+  // Camera index in the shared config, -1 when none was picked yet
+  int fullscreen;
+  // Bumped by the leader to make every node reload its layout file
+  int layout_generation;
+  int camera_count;
+} ClusterState;
+
+typedef struct {
+  ClusterRole role;
+  int fd;
+  struct sockaddr_in group;
+  uint32_t epoch;
+  uint32_t sequence;
+  int64_t sent_at_ms;
+  int synced;
+  long missed;
+} Cluster;
+
+ClusterRole cluster_role(const char *name);
+
+// group is "address:port", interface the local address used for multicast,
+// 127.0.0.1 keeps all traffic on loopback. Returns -1 on error.
+int cluster_open(Cluster *cluster, ClusterRole role, const char *group, const char *interface);
+
+// Sends a new state, the sequence number is assigned here.
+int cluster_publish(Cluster *cluster, ClusterState *state, int64_t now_ms);
+
+// Sends the current state again once a second so late or lossy followers catch up.
+void cluster_heartbeat(Cluster *cluster, const ClusterState *state, int64_t now_ms);
+
+// Reads every pending message, returns 1 and the newest state when it is newer than the last one.
+int cluster_receive(Cluster *cluster, ClusterState *state);
+
+// Splits cameras into contiguous ranges so each camera is shown by one node.
+void cluster_assign(int camera_count, int node_count, int node, int *first, int *count);
+
+void cluster_close(Cluster *cluster);
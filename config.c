@@ -63,8 +63,42 @@ static int handler(void *user, const char *section, const char *name, const char
         append_key_sym(config->key_map.previous, key_sym);
       else if (VALUE("reload"))
         append_key_sym(config->key_map.reload, key_sym);
+      else if (VALUE("replay"))
+        append_key_sym(config->key_map.replay, key_sym);
+      else if (VALUE("overlay"))
+        append_key_sym(config->key_map.overlay, key_sym);
+      else if (VALUE("trace"))
+        append_key_sym(config->key_map.trace, key_sym);
     } else if (MATCH("layout"))
       config->layout_file = strdup(value);
+    else if (MATCH("replay-budget"))
+      config->replay_budget = atoi(value);
+    else if (MATCH("replay-seconds"))
+      config->replay_seconds = atoi(value);
+    else if (MATCH("memory-budget"))
+      config->memory_budget = atoi(value);
+    else if (MATCH("isolate"))
+      config->isolate = VALUE("yes");
+    else if (MATCH("cpu-affinity"))
+      config->cpu_affinity = VALUE("yes");
+    else if (MATCH("auto-layout"))
+      config->auto_layout = VALUE("yes");
+    else if (MATCH("thumb-height"))
+      config->thumb_height = atoi(value);
+    else if (MATCH("thumb-threads"))
+      config->thumb_threads = atoi(value);
+    else if (MATCH("stats-interval"))
+      config->stats_interval = atoi(value);
+    else if (MATCH("cluster"))
+      config->cluster = strdup(value);
+    else if (MATCH("cluster-group"))
+      config->cluster_group = strdup(value);
+    else if (MATCH("cluster-interface"))
+      config->cluster_interface = strdup(value);
+    else if (MATCH("cluster-node"))
+      config->cluster_node = atoi(value);
+    else if (MATCH("cluster-nodes"))
+      config->cluster_nodes = atoi(value);
     else
       return 0;
     return 1;
@@ -93,6 +127,8 @@ static int handler(void *user, const char *section, const char *name, const char
     config->streams[index].main = strdup(value);
   else if (MATCH("sub"))
     config->streams[index].sub = strdup(value);
+  else if (MATCH("replay-quota"))
+    config->streams[index].replay_quota = strdup(value);
   else if (MATCH_MPV)
     parse_mpv_flag(&config->streams[index].mpv_flags, name, value, MPV_FLAG_PREFIX_LEN);
   else if (MATCH_MAIN_MPV)
@@ -105,16 +141,31 @@ static int handler(void *user, const char *section, const char *name, const char
   return 1;
 }
 
+int config_parse_file(Config *config, const char *file_path) {
+  return ini_parse(file_path, handler, config);
+}
+
 void config_parse(Config *config, int argc, const char *argv[]) {
+  // Lets several nodes of a cluster share one config file
+  const char *cluster = NULL;
+  int cluster_node = -1;
+
   flag_str(&config->config_file, "config", "Path to config file");
   flag_str(&config->layout_file, "layout", "Path to layout file");
+  flag_str(&cluster, "cluster", "Cluster role, leader or follower");
+  flag_int(&cluster_node, "cluster-node", "Node index in the cluster");
   flag_parse(argc, argv, VERSION);
 
   if (access(config->config_file, F_OK) == 0 &&
-      ini_parse(config->config_file, handler, config) < 0) {
+      config_parse_file(config, config->config_file) < 0) {
     fprintf(stderr, "failed to load '%s'\n", config->config_file);
     exit(1);
   }
+
+  if (cluster)
+    config->cluster = cluster;
+  if (cluster_node >= 0)
+    config->cluster_node = cluster_node;
 }
 
 void config_unique_merge_mpv_flags(ConfigMpvFlags *to, ConfigMpvFlags from) {
@@ -18,6 +18,7 @@ typedef struct {
   char *name;
   char *main;
   char *sub;
+  char *replay_quota;
   ConfigMpvFlags mpv_flags;
   ConfigMpvFlags main_mpv_flags;
   ConfigMpvFlags sub_mpv_flags;
@@ -29,11 +30,28 @@ typedef struct {
   KeySym next[MAX_KEYBINDINGS];
   KeySym previous[MAX_KEYBINDINGS];
   KeySym reload[MAX_KEYBINDINGS];
+  KeySym replay[MAX_KEYBINDINGS];
+  KeySym overlay[MAX_KEYBINDINGS];
+  KeySym trace[MAX_KEYBINDINGS];
 } ConfigKeyMap;
 
 typedef struct {
   const char *config_file;
   const char *layout_file;
+  int replay_budget;
+  int replay_seconds;
+  int memory_budget;
+  int isolate;
+  int cpu_affinity;
+  int auto_layout;
+  int thumb_height;
+  int thumb_threads;
+  int stats_interval;
+  const char *cluster;
+  const char *cluster_group;
+  const char *cluster_interface;
+  int cluster_node;
+  int cluster_nodes;
   ConfigMpvFlags mpv_flags;
   ConfigMpvFlags main_mpv_flags;
   ConfigMpvFlags sub_mpv_flags;
@@ -44,4 +62,6 @@ typedef struct {
 
 void config_parse(Config *config, int argc, const char *argv[]);
 
+int config_parse_file(Config *config, const char *file_path);
+
 void config_unique_merge_mpv_flags(ConfigMpvFlags *to, ConfigMpvFlags from);
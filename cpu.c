@@ -0,0 +1,127 @@
+#define _GNU_SOURCE
+#include "cpu.h"
+#include "util.h"
+#include <dirent.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Pixels one decoder thread is expected to keep up with
+static const int DECODER_THREAD_PIXELS = 640 * 720;
+static const int DECODER_MAX_THREADS = 16;
+
+static int read_topology_id(int cpu, const char *name) {
+  char path[128];
+  snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/topology/%s", cpu, name);
+  FILE *file = fopen(path, "r");
+  if (!file)
+    return cpu;
+  int id = cpu;
+  if (fscanf(file, "%d", &id) != 1)
+    id = cpu;
+  fclose(file);
+  return id;
+}
+
+int cpu_topology_load(CpuTopology *topology) {
+  cpu_set_t allowed;
+  if (sched_getaffinity(0, sizeof(allowed), &allowed) < 0)
+    return -1;
+
+  // Group SMT siblings since they share caches
+  int keys[CPU_MAX_CORES];
+  cpu_set_t cores[CPU_MAX_CORES];
+  int core_count = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE; cpu++) {
+    if (!CPU_ISSET(cpu, &allowed))
+      continue;
+
+    int key = read_topology_id(cpu, "physical_package_id") << 16 | read_topology_id(cpu, "core_id");
+    int core = 0;
+    while (core < core_count && keys[core] != key)
+      core++;
+    if (core == core_count) {
+      if (core_count == CPU_MAX_CORES)
+        break;
+      keys[core] = key;
+      CPU_ZERO(&cores[core]);
+      core_count++;
+    }
+    CPU_SET(cpu, &cores[core]);
+  }
+  if (core_count == 0)
+    return -1;
+
+  // The main loop gets the first core to itself unless it is the only one
+  topology->cpu_count = CPU_COUNT(&allowed);
+  topology->main_cpus = cores[0];
+  topology->core_count = core_count == 1 ? 1 : core_count - 1;
+  memcpy(topology->cores, core_count == 1 ? cores : &cores[1], topology->core_count * sizeof(cpu_set_t));
+  return 0;
+}
+
+cpu_set_t cpu_stream_cpus(const CpuTopology *topology, int index, int count) {
+  int groups = MAX(MIN(count, topology->core_count), 1);
+  int group = index % groups;
+
+  // Spread the cores evenly, the first groups get the remainder
+  int size = topology->core_count / groups;
+  int remainder = topology->core_count % groups;
+  int start = group * size + MIN(group, remainder);
+  int end = start + size + (group < remainder ? 1 : 0);
+
+  cpu_set_t cpus;
+  CPU_ZERO(&cpus);
+  for (int core = start; core < end; core++)
+    CPU_OR(&cpus, &cpus, &topology->cores[core]);
+  return cpus;
+}
+
+cpu_set_t cpu_all_stream_cpus(const CpuTopology *topology) {
+  return cpu_stream_cpus(topology, 0, 1);
+}
+
+int cpu_decoder_threads(int width, int height, const cpu_set_t *cpus) {
+  int threads = (int)((long)width * height / DECODER_THREAD_PIXELS) + 1;
+  return MAX(MIN(MIN(threads, CPU_COUNT(cpus)), DECODER_MAX_THREADS), 1);
+}
+
+int cpu_pin_thread(const cpu_set_t *cpus) {
+  return pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), cpus) == 0 ? 0 : -1;
+}
+
+int cpu_pin_process(pid_t pid, const cpu_set_t *cpus) {
+  char path[64];
+  snprintf(path, sizeof(path), "/proc/%d/task", pid);
+  DIR *dir = opendir(path);
+  if (!dir)
+    return -1;
+
+  int err = 0;
+  struct dirent *entry;
+  while ((entry = readdir(dir))) {
+    pid_t tid = atoi(entry->d_name);
+    if (tid > 0 && sched_setaffinity(tid, sizeof(cpu_set_t), cpus) < 0)
+      err = -1;
+  }
+  closedir(dir);
+  return err;
+}
+
+char *cpu_format(const cpu_set_t *cpus, char *buffer, int size) {
+  int length = 0;
+  buffer[0] = 0;
+  for (int cpu = 0; cpu < CPU_SETSIZE && length < size; cpu++) {
+    if (!CPU_ISSET(cpu, cpus) || (cpu > 0 && CPU_ISSET(cpu - 1, cpus)))
+      continue;
+    int last = cpu;
+    while (last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, cpus))
+      last++;
+    if (last == cpu)
+      length += snprintf(&buffer[length], size - length, "%s%d", length ? "," : "", cpu);
+    else
+      length += snprintf(&buffer[length], size - length, "%s%d-%d", length ? "," : "", cpu, last);
+  }
+  return buffer;
+}
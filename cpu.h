@@ -0,0 +1,33 @@
+#pragma once
+
+#include <sched.h>
+#include <sys/types.h>
+
+#define CPU_MAX_CORES 256
+
+typedef struct {
+  int cpu_count;
+  // CPUs reserved for the main loop
+  cpu_set_t main_cpus;
+  // CPUs left for streams, grouped by physical core
+  int core_count;
+  cpu_set_t cores[CPU_MAX_CORES];
+} CpuTopology;
+
+int cpu_topology_load(CpuTopology *topology);
+
+// Splits the stream cores into groups and returns the group of a stream.
+cpu_set_t cpu_stream_cpus(const CpuTopology *topology, int index, int count);
+
+// All CPUs that are not reserved for the main loop.
+cpu_set_t cpu_all_stream_cpus(const CpuTopology *topology);
+
+int cpu_decoder_threads(int width, int height, const cpu_set_t *cpus);
+
+int cpu_pin_thread(const cpu_set_t *cpus);
+
+// Pins every thread of another process, used for player processes.
+int cpu_pin_process(pid_t pid, const cpu_set_t *cpus);
+
+// Formats the CPU list like the kernel does, e.g. "0-3,8".
+char *cpu_format(const cpu_set_t *cpus, char *buffer, int size);
@@ -2,9 +2,17 @@
 #include "inih/ini.h"
 #include "util.h"
 #include <math.h>
+#include <stdint.h>
 #include <stdlib.h>
 #include <string.h>
 
+// Aspect ratio assumed until the video size is known
+#define DEFAULT_ASPECT (16.0 / 9.0)
+// How close a scale must be to 2, 1, 1/2 or 1/4 to count as clean
+#define CLEAN_SCALE_TOLERANCE 0.02
+// Extra weight of a pane with a clean scale, small enough to only break near ties
+#define CLEAN_SCALE_BONUS 0.02
+
 LayoutGrid layout_grid_new(int width, int height, int count) {
   int columns = 0;
   int rows = 0;
@@ -24,29 +32,108 @@ LayoutGrid layout_grid_new(int width, int height, int count) {
       .pane_width = pane_width,
       .pane_height = pane_height,
       .columns = columns,
+      .rows = rows,
+  };
+  return g;
+}
+
+static LayoutGrid grid_with_columns(int width, int height, int count, int columns) {
+  int rows = (count + columns - 1) / columns;
+  LayoutGrid g = {
+      .width = width,
+      .height = height,
+      .pane_width = width / columns,
+      .pane_height = height / rows,
+      .columns = columns,
+      .rows = rows,
   };
   return g;
 }
 
+// Fits a source into a pane keeping its aspect ratio, returns the scale or 0 when unknown.
+static double fit(LayoutSource source, int width, int height, double *area) {
+  if (source.width <= 0 || source.height <= 0) {
+    double fitted_width = MIN(width, height * DEFAULT_ASPECT);
+    *area = fitted_width * (fitted_width / DEFAULT_ASPECT);
+    return 0;
+  }
+
+  double scale = MIN((double)width / source.width, (double)height / source.height);
+  *area = source.width * scale * source.height * scale;
+  return scale;
+}
+
+static int is_clean_scale(double scale) {
+  static const double clean[] = {2, 1, 0.5, 0.25};
+  for (int i = 0; i < sizeof(clean) / sizeof(clean[0]); i++)
+    if (fabs(scale - clean[i]) <= clean[i] * CLEAN_SCALE_TOLERANCE)
+      return 1;
+  return 0;
+}
+
+static double grid_score(LayoutGrid layout_grid, int count, const LayoutSource sources[], double *displayed) {
+  double score = 0;
+  *displayed = 0;
+  for (int i = 0; i < count; i++) {
+    LayoutWindow w = layout_grid_window(layout_grid, i);
+    double area;
+    double scale = fit(sources[i], w.width, w.height, &area);
+    *displayed += area;
+    score += is_clean_scale(scale) ? area * (1 + CLEAN_SCALE_BONUS) : area;
+  }
+  return score;
+}
+
+LayoutGrid layout_grid_solve(int width, int height, int count, const LayoutSource sources[]) {
+  LayoutGrid best = layout_grid_new(width, height, count);
+  if (count <= 1)
+    return best;
+
+  double displayed;
+  double best_score = grid_score(best, count, sources, &displayed);
+  for (int columns = 1; columns <= count; columns++) {
+    LayoutGrid g = grid_with_columns(width, height, count, columns);
+    double score = grid_score(g, count, sources, &displayed);
+    if (score > best_score) {
+      best = g;
+      best_score = score;
+    }
+  }
+  return best;
+}
+
+double layout_grid_displayed_area(LayoutGrid layout_grid, int count, const LayoutSource sources[]) {
+  double displayed;
+  grid_score(layout_grid, count, sources, &displayed);
+  return displayed;
+}
+
+// Pane edges are rounded from the exact grid lines so leftover pixels are
+// spread between panes instead of left empty at the right and bottom.
 LayoutWindow layout_grid_window(LayoutGrid layout_grid, int index) {
-  int row = floor((double)index / layout_grid.columns);
+  int row = index / layout_grid.columns;
   int col = index % layout_grid.columns;
+  int rows = MAX(layout_grid.rows, 1);
 
+  int x = (int64_t)layout_grid.width * col / layout_grid.columns;
+  int y = (int64_t)layout_grid.height * row / rows;
   LayoutWindow layout_pane = {
-      .x = layout_grid.pane_width * col,
-      .y = layout_grid.pane_height * row,
-      .width = layout_grid.pane_width,
-      .height = layout_grid.pane_height,
+      .x = x,
+      .y = y,
+      .width = (int64_t)layout_grid.width * (col + 1) / layout_grid.columns - x,
+      .height = (int64_t)layout_grid.height * (row + 1) / rows - y,
   };
   return layout_pane;
 }
 
 LayoutWindow layout_pane_window(LayoutPane pane, int width, int height) {
+  int x = (int)round(pane.x * width);
+  int y = (int)round(pane.y * height);
   LayoutWindow w = {
-      .x = (int)(pane.x * width),
-      .y = (int)(pane.y * height),
-      .width = (int)(pane.width * width),
-      .height = (int)(pane.height * height),
+      .x = x,
+      .y = y,
+      .width = (int)round((pane.x + pane.width) * width) - x,
+      .height = (int)round((pane.y + pane.height) * height) - y,
   };
   return w;
 }
@@ -22,8 +22,15 @@ typedef struct {
   int pane_width;
   int pane_height;
   int columns;
+  int rows;
 } LayoutGrid;
 
+// Native video size of a stream, zero when it is not known yet.
+typedef struct {
+  int width;
+  int height;
+} LayoutSource;
+
 typedef struct {
   char *name;
   int pane_count;
@@ -32,6 +39,14 @@ typedef struct {
 
 LayoutGrid layout_grid_new(int width, int height, int count);
 
+// Picks the number of columns that shows the most video once every source is
+// fitted into its pane, preferring panes where the video scales by 2, 1, 1/2
+// or 1/4.
+LayoutGrid layout_grid_solve(int width, int height, int count, const LayoutSource sources[]);
+
+// Area of the fitted video in all panes, letterboxing excluded.
+double layout_grid_displayed_area(LayoutGrid layout_grid, int count, const LayoutSource sources[]);
+
 LayoutWindow layout_grid_window(LayoutGrid layout_grid, int index);
 
 LayoutWindow layout_pane_window(LayoutPane pane, int width, int height);
@@ -1,381 +1,469 @@
+#define _GNU_SOURCE
 #include "main.h"
+#include "activity.h"
+#include "child.h"
 #include "clock.h"
+#include "cluster.h"
 #include "config.h"
+#include "cpu.h"
 #include "layout.h"
+#include "memory.h"
+#include "player.h"
+#include "pool.h"
+#include "stream.h"
+#include "thumb.h"
+#include "trace.h"
 #include "util.h"
+#include "view.h"
 #include <X11/Xlib.h>
+#include <X11/keysym.h>
 #include <mpv/client.h>
 #include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include <xcb/xcb.h>
 
-typedef enum {
-  COMMAND_SYNC_X11 = 0x00000001,
-  COMMAND_SYNC_MPV = 0x00000010,
-  COMMAND_SYNC_SPEED = 0x00000100,
-} Command;
-
-typedef enum {
-  VIEW_GRID,
-  VIEW_FULLSCREEN,
-  VIEW_LAYOUT,
-} View;
-
-typedef struct {
-  KeyCode quit[MAX_KEYBINDINGS];
-  KeyCode home[MAX_KEYBINDINGS];
-  KeyCode next[MAX_KEYBINDINGS];
-  KeyCode previous[MAX_KEYBINDINGS];
-  KeyCode reload[MAX_KEYBINDINGS];
-} KeyMap;
-
-typedef struct {
-  Window window;
-  mpv_handle *mpv;
-  char *name;
-  char *main;
-  char *sub;
-  double speed;
-  int speed_updated_at;
-  int pinged_at;
-  ConfigMpvFlags main_mpv_flags;
-  ConfigMpvFlags sub_mpv_flags;
-} StreamState;
-
-typedef struct {
-  KeyMap key_map;
-
-  Window window;
-  int width;
-  int height;
-
-  View view;
-  View default_view;
-  const char *layout_file_path;
-  LayoutFile layout_file;
-
-  Window active_stream_window;
-  Window fullscreen_stream_window;
-  int stream_count;
-  StreamState streams[MAX_STREAMS];
-
-} State;
-
-const static char *MPV_PROPERTY_DEMUXER_CACHE_TIME = "demuxer-cache-time";
-const char *MPV_PROPERTY_TIME_REMAINING = "time-remaining";
-const double MPV_MAX_DELAY_SEC = 0.5;
-const double MPV_MIN_DISPLAY_SEC = 0.1;
-const int MPV_TIMEOUT_SEC = 5;
+// Threads taking screenshots of in-process players for auto layout
+const static int ACTIVITY_THREADS = 4;
 
 static int time_now() { return (int)time(NULL); }
 
-static int on_x11_error(Display *d, XErrorEvent *e) {
-  fprintf(stderr, "xlib: %d\n", e->error_code);
-  return 0;
+static int64_t time_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
 }
 
-static Display *display;
-static Atom wm_delete_window;
-static State *state;
-
-void setup() {
-  XSetErrorHandler(on_x11_error);
+static xcb_connection_t *connection;
+static xcb_screen_t *screen;
+static xcb_atom_t wm_delete_window;
+static Config player_config;
+#ifdef THUMBS
+static uint8_t thumb_completion;
+#endif
+
+// Set from SIGUSR1, the trace is written by the main loop
+static volatile sig_atomic_t trace_requested;
+
+static void request_trace(int sig) { trace_requested = 1; }
+
+static const char *x11_error_name(uint8_t code) {
+  static const char *names[] = {
+      [XCB_REQUEST] = "BadRequest",
+      [XCB_VALUE] = "BadValue",
+      [XCB_WINDOW] = "BadWindow",
+      [XCB_PIXMAP] = "BadPixmap",
+      [XCB_ATOM] = "BadAtom",
+      [XCB_CURSOR] = "BadCursor",
+      [XCB_FONT] = "BadFont",
+      [XCB_MATCH] = "BadMatch",
+      [XCB_DRAWABLE] = "BadDrawable",
+      [XCB_ACCESS] = "BadAccess",
+      [XCB_ALLOC] = "BadAlloc",
+      [XCB_COLORMAP] = "BadColormap",
+      [XCB_G_CONTEXT] = "BadGC",
+      [XCB_ID_CHOICE] = "BadIDChoice",
+      [XCB_NAME] = "BadName",
+      [XCB_LENGTH] = "BadLength",
+      [XCB_IMPLEMENTATION] = "BadImplementation",
+  };
+  if (code < sizeof(names) / sizeof(names[0]) && names[code])
+    return names[code];
+  return "unknown error";
+}
 
-  display = XOpenDisplay(NULL);
-  if (display == NULL)
-    die("failed to open display");
+static const char *x11_request_name(uint8_t opcode) {
+  switch (opcode) {
+  case XCB_CREATE_WINDOW:
+    return "CreateWindow";
+  case XCB_CHANGE_WINDOW_ATTRIBUTES:
+    return "ChangeWindowAttributes";
+  case XCB_MAP_WINDOW:
+    return "MapWindow";
+  case XCB_UNMAP_WINDOW:
+    return "UnmapWindow";
+  case XCB_CONFIGURE_WINDOW:
+    return "ConfigureWindow";
+  case XCB_CHANGE_PROPERTY:
+    return "ChangeProperty";
+  default:
+    return "unknown request";
+  }
+}
 
-  Window root = XDefaultRootWindow(display);
-  XSelectInput(display, root, StructureNotifyMask);
+static void on_x11_error(xcb_generic_error_t *e) {
+  const char *name = "unknown";
+  if (e->resource_id == state->window)
+    name = "main";
+  for (int i = 0; i < state->stream_count; i++)
+    if (state->streams[i].window == e->resource_id)
+      name = state->streams[i].name;
 
-  XWindowAttributes root_window_attribute;
-  if (XGetWindowAttributes(display, root, &root_window_attribute) < 0)
-    die("failed to get root window size");
+  fprintf(stderr, "xcb: %s: %s on window 0x%x (%s)\n", x11_request_name(e->major_code),
+          x11_error_name(e->error_code), e->resource_id, name);
+}
 
-  Window window =
-      XCreateSimpleWindow(display, root, 0, 0, root_window_attribute.width,
-                          root_window_attribute.height, 0, 0, 0);
-  if (window == 0)
-    die("failed to create window");
+static xcb_atom_t x11_atom_reply(xcb_intern_atom_cookie_t cookie) {
+  xcb_intern_atom_reply_t *reply = xcb_intern_atom_reply(connection, cookie, NULL);
+  if (reply == NULL)
+    die("failed to intern atom");
+  xcb_atom_t atom = reply->atom;
+  free(reply);
+  return atom;
+}
 
-  XSelectInput(display, window, StructureNotifyMask | KeyPressMask);
+// Blocks until the X server has processed every queued request.
+static void x11_sync() {
+  state->x11_round_trips++;
+  free(xcb_get_input_focus_reply(connection, xcb_get_input_focus(connection), NULL));
+}
 
-  wm_delete_window = XInternAtom(display, "WM_DELETE_WINDOW", False);
-  XSetWMProtocols(display, window, &wm_delete_window, 1);
+static void x11_configure_window(xcb_window_t window, int x, int y, int width, int height, int border_width) {
+  uint32_t values[] = {x, y, MAX(width, 1), MAX(height, 1), border_width};
+  xcb_configure_window(connection, window,
+                       XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y | XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT | XCB_CONFIG_WINDOW_BORDER_WIDTH,
+                       values);
+}
 
-  XMapWindow(display, window);
+void setup() {
+  state = calloc(1, sizeof(State));
+  state->now_ms = time_now_ms();
 
-  XWindowAttributes window_attribute;
-  if (XGetWindowAttributes(display, window, &window_attribute) < 0)
-    die("failed to get window size");
+  int screen_number;
+  connection = xcb_connect(NULL, &screen_number);
+  if (xcb_connection_has_error(connection))
+    die("failed to open display");
 
-  state = calloc(1, sizeof(State));
+  xcb_screen_iterator_t screens = xcb_setup_roots_iterator(xcb_get_setup(connection));
+  for (int i = 0; i < screen_number; i++)
+    xcb_screen_next(&screens);
+  screen = screens.data;
+  if (screen == NULL)
+    die("failed to find screen");
+
+  // Send the atom requests first so their replies arrive while the window is being created
+  xcb_intern_atom_cookie_t wm_protocols_cookie = xcb_intern_atom(connection, 0, strlen("WM_PROTOCOLS"), "WM_PROTOCOLS");
+  xcb_intern_atom_cookie_t wm_delete_window_cookie = xcb_intern_atom(connection, 0, strlen("WM_DELETE_WINDOW"), "WM_DELETE_WINDOW");
+
+  uint32_t root_values[] = {XCB_EVENT_MASK_STRUCTURE_NOTIFY};
+  xcb_change_window_attributes(connection, screen->root, XCB_CW_EVENT_MASK, root_values);
+
+  // The root window size is part of the connection setup, so no request is needed
+  xcb_window_t window = xcb_generate_id(connection);
+  uint32_t window_values[] = {screen->black_pixel, XCB_EVENT_MASK_STRUCTURE_NOTIFY | XCB_EVENT_MASK_KEY_PRESS};
+  xcb_create_window(connection, XCB_COPY_FROM_PARENT, window, screen->root, 0, 0,
+                    screen->width_in_pixels, screen->height_in_pixels, 0,
+                    XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
+                    XCB_CW_BACK_PIXEL | XCB_CW_EVENT_MASK, window_values);
+
+  // Both replies come back in the same round trip
+  state->x11_round_trips++;
+  xcb_atom_t wm_protocols = x11_atom_reply(wm_protocols_cookie);
+  wm_delete_window = x11_atom_reply(wm_delete_window_cookie);
+  xcb_change_property(connection, XCB_PROP_MODE_REPLACE, window, wm_protocols, XCB_ATOM_ATOM, 32, 1, &wm_delete_window);
+
+  xcb_map_window(connection, window);
+
+  state->connection = connection;
   state->window = window;
-  state->width = window_attribute.width;
-  state->height = window_attribute.height;
+  state->width = screen->width_in_pixels;
+  state->height = screen->height_in_pixels;
 }
 
 void *_destroy(void *ptr) {
-  mpv_handle *mpv = ptr;
-  mpv_destroy(mpv);
+  player_destroy(ptr);
   return NULL;
 }
 
 void destory() {
-  // Concurrently shutdown all mpv handles
-  pthread_t *threads = malloc(state->stream_count * sizeof(pthread_t));
-  for (int i = 0; i < state->stream_count; i++)
-    pthread_create(&threads[i], NULL, _destroy, state->streams[i].mpv);
-  for (int i = 0; i < state->stream_count; i++)
+  // Children shutdown their mpv handle when the socket is closed, close them all before waiting on any
+  if (state->isolate) {
+    for (int i = 0; i < state->stream_count; i++)
+      if (state->streams[i].child)
+        child_close(state->streams[i].child);
+    child_spawner_stop();
+  }
+
+  // Concurrently shutdown all players
+  int thread_count = 0;
+  pthread_t *threads = malloc(state->stream_count * 2 * sizeof(pthread_t));
+  for (int i = 0; i < state->stream_count; i++) {
+    if (state->streams[i].full_player)
+      pthread_create(&threads[thread_count++], NULL, _destroy, state->streams[i].full_player);
+    if (state->streams[i].thumb_player)
+      pthread_create(&threads[thread_count++], NULL, _destroy, state->streams[i].thumb_player);
+  }
+  for (int i = 0; i < thread_count; i++)
     pthread_join(threads[i], NULL);
   free(threads);
-
-  XCloseDisplay(display);
+  if (state->thumb_pool)
+    pool_free(state->thumb_pool);
+  if (state->activity_pool)
+    pool_free(state->activity_pool);
+  if (state->cluster.role)
+    cluster_close(&state->cluster);
+
+  xcb_disconnect(connection);
 }
 
-void player_loadfile(int stream_i, char *stream) {
-  const char *cmd[] = {"loadfile", stream, NULL};
-  int err = mpv_command(state->streams[stream_i].mpv, cmd) < 0;
-  if (err < 0)
-    fprintf(stderr, "%s: failed to play file: %d\n", state->streams[stream_i].name, err);
+void dump_trace() {
+#ifdef TRACE
+  char path[64];
+  snprintf(path, sizeof(path), "camviewport-%d.trace.json", time_now());
+  if (trace_dump(path) < 0)
+    fprintf(stderr, "trace: failed to write '%s'\n", path);
+  else
+    fprintf(stderr, "trace: written to %s\n", path);
+#else
+  fprintf(stderr, "trace: built without TRACE=1\n");
+#endif
 }
 
-void player_stop(int stream_i) {
-  const char *cmd[] = {"stop", NULL};
-  int err = mpv_command(state->streams[stream_i].mpv, cmd) < 0;
-  if (err < 0)
-    fprintf(stderr, "%s: failed to stop file: %d\n", state->streams[stream_i].name, err);
+void apply_mpv_flags_option(mpv_handle *mpv, ConfigMpvFlags flags) {
+  for (int i = 0; i < flags.count; i++)
+    mpv_set_option_string(mpv, flags.flags[i].name, flags.flags[i].data);
 }
 
-void player_set_speed(int stream_i, double speed) {
-  int err = mpv_set_property(state->streams[stream_i].mpv, "speed", MPV_FORMAT_DOUBLE, &speed);
-  if (err < 0)
-    fprintf(stderr, "%s: failed to set speed: %d\n", state->streams[stream_i].name, err);
+mpv_handle *create_mpv(int stream_i) {
+  mpv_handle *mpv = mpv_create();
+
+  if (mpv == NULL)
+    die("failed to create mpv context");
+
+  int64_t wid = state->streams[stream_i].window;
+  mpv_set_option(mpv, "wid", MPV_FORMAT_INT64, &wid);
+  // mpv_set_option_string(mpv, "idle", "yes");
+  // mpv_set_option_string(mpv, "force-window", "yes");
+  mpv_set_option_string(mpv, "profile", "low-latency");
+  mpv_set_option_string(mpv, "cache", "now");
+  mpv_set_option_string(mpv, "input-cursor", "no"); // FIXME: this causes the cursor disappears on a sub window when alt-tab is pressed, it only happens to sub window the cursor is hovering
+  mpv_set_option_string(mpv, "ao", "null");         // FIXME: audio other than null causes crashes when started with startx
+
+  // Keep already played packets for replay, this does not change how far ahead the demuxer reads
+  if (state->streams[stream_i].replay_quota > 0) {
+    char back_bytes[32];
+    snprintf(back_bytes, sizeof(back_bytes), "%dMiB", state->streams[stream_i].replay_quota);
+    mpv_set_option_string(mpv, "demuxer-max-back-bytes", back_bytes);
+    mpv_set_option_string(mpv, "demuxer-seekable-cache", "yes");
+  }
+
+  // Apply global and scoped options
+  ConfigMpvFlags options = {};
+  config_unique_merge_mpv_flags(&options, player_config.mpv_flags);
+  config_unique_merge_mpv_flags(&options, player_config.streams[stream_i].mpv_flags);
+  apply_mpv_flags_option(mpv, options);
+
+  mpv_observe_property(mpv, 0, MPV_PROPERTY_PLAYBACK_TIME, MPV_FORMAT_DOUBLE);
+  mpv_observe_property(mpv, 0, MPV_PROPERTY_FPS, MPV_FORMAT_DOUBLE);
+  mpv_observe_property(mpv, 0, MPV_PROPERTY_BITRATE, MPV_FORMAT_DOUBLE);
+  mpv_observe_property(mpv, 0, MPV_PROPERTY_FRAME_DROPS, MPV_FORMAT_INT64);
+  mpv_observe_property(mpv, 0, MPV_PROPERTY_DECODER_DROPS, MPV_FORMAT_INT64);
+  mpv_observe_property(mpv, 0, MPV_PROPERTY_WIDTH, MPV_FORMAT_INT64);
+  mpv_observe_property(mpv, 0, MPV_PROPERTY_HEIGHT, MPV_FORMAT_INT64);
+  mpv_observe_property(mpv, 0, MPV_PROPERTY_DEMUXER_CACHE_TIME, MPV_FORMAT_DOUBLE);
+  if (state->memory_budget)
+    mpv_observe_property(mpv, 0, MPV_PROPERTY_DEMUXER_CACHE_STATE, MPV_FORMAT_NODE);
+
+  if (mpv_initialize(mpv) < 0)
+    die("failed to init mpv");
+
+  mpv_request_log_messages(mpv, "info");
+
+  return mpv;
 }
 
-Command update_size(int width, int height) {
-  state->width = width;
-  state->height = height;
-  return COMMAND_SYNC_X11;
+// Runs in the child process, which must not use the parent's X connection.
+mpv_handle *create_child_mpv(int stream_i) {
+  close(xcb_get_file_descriptor(connection));
+  if (state->cpu)
+    sched_setaffinity(0, sizeof(cpu_set_t), &state->streams[stream_i].cpus);
+  return create_mpv(stream_i);
 }
 
-Command toggle_fullscreen(Window window) {
-  if (state->view == VIEW_FULLSCREEN) {
-    state->view = state->default_view;
-  } else if (window) {
-    state->view = VIEW_FULLSCREEN;
-    state->fullscreen_stream_window = window;
-  } else if (state->fullscreen_stream_window) {
-    state->view = VIEW_FULLSCREEN;
-  } else if (state->stream_count > 0) {
-    state->view = VIEW_FULLSCREEN;
-    state->fullscreen_stream_window = state->streams[0].window;
+Player *create_player(int stream_i) {
+  StreamState *stream = &state->streams[stream_i];
+  if (state->isolate) {
+    stream->child = child_spawn(stream->name, stream_i);
+    return player_child_new(stream->name, stream->child);
   }
-  return COMMAND_SYNC_X11 | COMMAND_SYNC_MPV;
+  return player_mpv_new(stream->name, create_mpv(stream_i), state->activity_pool);
 }
 
-Command activate_window(Window window) {
-  if (window == state->active_stream_window)
+// Shows the wall state sent by the leader, a camera goes fullscreen only on the node that owns it.
+Command apply_cluster(ClusterState cluster_state) {
+  // Indices only match when every node was given the same cameras
+  if (cluster_state.camera_count != state->cluster_state.camera_count) {
+    fprintf(stderr, "cluster: leader has %d cameras, this node was configured with %d\n",
+            cluster_state.camera_count, state->cluster_state.camera_count);
     return 0;
-  state->active_stream_window = window;
-  return COMMAND_SYNC_X11;
-}
-
-Command go_next() {
-  int index = state->stream_count - 1;
+  }
 
-  if (state->view == VIEW_FULLSCREEN)
-    for (int i = 0; i < state->stream_count; i++)
-      if (state->streams[i].window == state->fullscreen_stream_window) {
-        index = i;
-        break;
-      }
+  Command command = 0;
+  if (cluster_state.layout_generation != state->cluster_state.layout_generation)
+    command |= reload_layout_file();
 
-  state->view = VIEW_FULLSCREEN;
-  state->fullscreen_stream_window = state->streams[(index + 1) % state->stream_count].window;
-  return COMMAND_SYNC_X11 | COMMAND_SYNC_MPV;
-}
+  int index = cluster_state.fullscreen - state->cluster_first;
+  xcb_window_t window = 0;
+  if (cluster_state.view == CLUSTER_VIEW_FULLSCREEN && index >= 0 && index < state->stream_count)
+    window = state->streams[index].window;
 
-Command go_previous() {
-  int index = 0;
+  if (window && (state->view != VIEW_FULLSCREEN || state->fullscreen_stream_window != window)) {
+    state->view = VIEW_FULLSCREEN;
+    state->fullscreen_stream_window = window;
+    command |= COMMAND_SYNC_X11 | COMMAND_SYNC_MPV;
+  } else if (!window && state->view == VIEW_FULLSCREEN) {
+    state->view = state->default_view;
+    command |= COMMAND_SYNC_X11 | COMMAND_SYNC_MPV;
+  }
 
-  if (state->view == VIEW_FULLSCREEN)
-    for (int i = 0; i < state->stream_count; i++)
-      if (state->streams[i].window == state->fullscreen_stream_window) {
-        index = i;
-        break;
-      }
+  state->cluster_state = cluster_state;
+  return command;
+}
 
-  state->view = VIEW_FULLSCREEN;
-  state->fullscreen_stream_window = state->streams[index - 1 >= 0 ? index - 1 : state->stream_count - 1].window;
-  return COMMAND_SYNC_X11 | COMMAND_SYNC_MPV;
+Command publish_cluster(ClusterState next) {
+  cluster_publish(&state->cluster, &next, time_now_ms());
+  return apply_cluster(next);
 }
 
-int is_mpv_playing(int index) {
-  switch (state->view) {
-  case VIEW_FULLSCREEN:
-    return state->fullscreen_stream_window == state->streams[index].window;
-  case VIEW_GRID:
-  case VIEW_LAYOUT:
-    return 1;
-  default:
+// Leader versions of the view actions, followers leave the view to the leader
+Command cluster_toggle_fullscreen(xcb_window_t window) {
+  if (state->cluster.role != CLUSTER_LEADER)
     return 0;
+
+  ClusterState next = state->cluster_state;
+  int index = find_stream(window);
+  if (next.view == CLUSTER_VIEW_FULLSCREEN) {
+    next.view = CLUSTER_VIEW_DEFAULT;
+  } else if (index >= 0) {
+    next.view = CLUSTER_VIEW_FULLSCREEN;
+    next.fullscreen = state->cluster_first + index;
+  } else if (next.camera_count > 0) {
+    next.view = CLUSTER_VIEW_FULLSCREEN;
+    next.fullscreen = MAX(next.fullscreen, 0);
   }
+  return publish_cluster(next);
 }
 
-void apply_mpv_flags_property(mpv_handle *mpv, ConfigMpvFlags flags) {
-  for (int i = 0; i < flags.count; i++)
-    mpv_set_property_string(mpv, flags.flags[i].name, flags.flags[i].data);
+Command cluster_go(int step) {
+  if (state->cluster.role != CLUSTER_LEADER || state->cluster_state.camera_count == 0)
+    return 0;
+
+  ClusterState next = state->cluster_state;
+  if (next.view == CLUSTER_VIEW_FULLSCREEN)
+    next.fullscreen = (next.fullscreen + step + next.camera_count) % next.camera_count;
+  else
+    next.fullscreen = step > 0 ? 0 : next.camera_count - 1;
+  next.view = CLUSTER_VIEW_FULLSCREEN;
+  return publish_cluster(next);
 }
 
-void apply_mpv_flags_option(mpv_handle *mpv, ConfigMpvFlags flags) {
-  for (int i = 0; i < flags.count; i++)
-    mpv_set_option_string(mpv, flags.flags[i].name, flags.flags[i].data);
+Command cluster_reload_layout_file() {
+  if (state->cluster.role != CLUSTER_LEADER)
+    return 0;
+
+  ClusterState next = state->cluster_state;
+  next.layout_generation = (next.layout_generation + 1) & 0xffff;
+  return publish_cluster(next);
 }
 
-void sync_mpv(int index) {
-  // printf("DEBUG: syncing mpv: %d\n", index);
-  mpv_handle *mpv = state->streams[index].mpv;
+static xcb_keycode_t keysym_to_keycode(xcb_get_keyboard_mapping_reply_t *mapping, KeySym key_sym) {
+  if (key_sym == NoSymbol)
+    return 0;
 
-  switch (state->view) {
-  case VIEW_FULLSCREEN: {
-    if (state->fullscreen_stream_window == state->streams[index].window) {
-      player_loadfile(index, state->streams[index].main);
-      apply_mpv_flags_property(mpv, state->streams[index].main_mpv_flags);
-    } else {
-      player_stop(index);
-    }
+  // Keys with a single keysym only list the uppercase letter
+  KeySym upper = key_sym >= XK_a && key_sym <= XK_z ? key_sym - (XK_a - XK_A) : key_sym;
 
-    break;
-  }
-  case VIEW_GRID: {
-    if (state->stream_count == 1) {
-      player_loadfile(index, state->streams[index].main);
-      apply_mpv_flags_property(mpv, state->streams[index].main_mpv_flags);
+  xcb_keysym_t *key_syms = xcb_get_keyboard_mapping_keysyms(mapping);
+  int length = xcb_get_keyboard_mapping_keysyms_length(mapping);
+  for (int i = 0; i < length; i++)
+    if (key_syms[i] == key_sym || key_syms[i] == upper)
+      return xcb_get_setup(connection)->min_keycode + i / mapping->keysyms_per_keycode;
+  return 0;
+}
+
+// Splits the replay budget between streams, streams with their own quota are served first.
+static void load_replay_quotas(Config config) {
+  int remaining = MAX(config.replay_budget, 0);
+  int shared = 0;
+  for (int i = 0; i < config.stream_count; i++) {
+    if (config.streams[i].replay_quota) {
+      state->streams[i].replay_quota = MIN(MAX(atoi(config.streams[i].replay_quota), 0), remaining);
+      remaining -= state->streams[i].replay_quota;
     } else {
-      player_loadfile(index, state->streams[index].sub);
-      apply_mpv_flags_property(mpv, state->streams[index].sub_mpv_flags);
+      shared++;
     }
-
-    break;
-  }
-  case VIEW_LAYOUT: {
-    player_loadfile(index, state->streams[index].sub);
-    apply_mpv_flags_property(mpv, state->streams[index].sub_mpv_flags);
-    break;
   }
-  }
-}
 
-void sync_mpv_speed(int index) {
-  // printf("DEBUG: syncing mpv speed: %d\n", index);
-  player_set_speed(index, state->streams[index].speed);
+  for (int i = 0; i < config.stream_count; i++)
+    if (!config.streams[i].replay_quota)
+      state->streams[i].replay_quota = remaining / shared;
 }
 
-void sync_x11() {
-  // printf("DEBUG: syncing x11\n");
-  switch (state->view) {
-  case VIEW_FULLSCREEN: {
-    for (int i = 0; i < state->stream_count; i++) {
-      if (state->streams[i].window == state->fullscreen_stream_window) {
-        XWindowChanges changes = {.x = 0,
-                                  .y = 0,
-                                  .width = state->width,
-                                  .height = state->height,
-                                  .border_width = 0};
-        XConfigureWindow(display, state->streams[i].window, CWX | CWY | CWWidth | CWHeight | CWBorderWidth, &changes);
-        XMapWindow(display, state->streams[i].window);
-      } else {
-        XUnmapWindow(display, state->streams[i].window);
-      }
-    }
-
-    break;
-  }
-  case VIEW_GRID: {
-    if (state->stream_count == 0) {
-      XWindowChanges changes = {.x = 0,
-                                .y = 0,
-                                .width = state->width,
-                                .height = state->height,
-                                .border_width = 0};
-      XConfigureWindow(display, state->streams[0].window, CWX | CWY | CWWidth | CWHeight | CWBorderWidth, &changes);
-      XMapWindow(display, state->streams[0].window);
-    } else {
-      LayoutGrid layout = layout_grid_new(state->width, state->height, state->stream_count);
-      for (int i = 0; i < state->stream_count; i++) {
-        LayoutWindow pane = layout_grid_window(layout, i);
-        XWindowChanges changes = {.x = pane.x,
-                                  .y = pane.y,
-                                  .width = pane.width - BORDER_WIDTH * 2,
-                                  .height = pane.height - BORDER_WIDTH * 2,
-                                  .border_width = BORDER_WIDTH};
-        XConfigureWindow(display, state->streams[i].window, CWX | CWY | CWWidth | CWHeight | CWBorderWidth, &changes);
-        XMapWindow(display, state->streams[i].window);
-      }
+void load_config(Config config) {
+  // Load key map with a single request for the whole keyboard
+  const xcb_setup_t *setup = xcb_get_setup(connection);
+  xcb_get_keyboard_mapping_cookie_t mapping_cookie =
+      xcb_get_keyboard_mapping(connection, setup->min_keycode, setup->max_keycode - setup->min_keycode + 1);
+
+  // Load cluster, each node only plays the cameras it shows
+  if (config.cluster) {
+    ClusterRole role = cluster_role(config.cluster);
+    int node_count = MAX(config.cluster_nodes, 1);
+    if (role == CLUSTER_NONE) {
+      fprintf(stderr, "cluster: unknown role '%s'\n", config.cluster);
+      exit(1);
     }
-
-    break;
-  }
-  case VIEW_LAYOUT: {
-    int visible = MIN(state->stream_count, state->layout_file.pane_count);
-    for (int i = 0; i < visible; i++) {
-      XWindowChanges changes = {
-          .x = state->layout_file.panes[i].x * state->width,
-          .y = state->layout_file.panes[i].y * state->height,
-          .width = state->layout_file.panes[i].width * state->width -
-                   BORDER_WIDTH * 2,
-          .height = state->layout_file.panes[i].height * state->height -
-                    BORDER_WIDTH * 2,
-          .border_width = BORDER_WIDTH,
-      };
-      XConfigureWindow(display, state->streams[i].window, CWX | CWY | CWWidth | CWHeight | CWBorderWidth, &changes);
-      XMapWindow(display, state->streams[i].window);
+    if (config.cluster_node < 0 || config.cluster_node >= node_count) {
+      fprintf(stderr, "cluster: node %d is not in 0-%d\n", config.cluster_node, node_count - 1);
+      exit(1);
     }
+    if (cluster_open(&state->cluster, role, config.cluster_group ? config.cluster_group : "239.255.0.42:7420",
+                     config.cluster_interface) < 0)
+      exit(1);
 
-    for (int i = visible; i < state->stream_count; i++)
-      XUnmapWindow(display, state->streams[i].window);
+    int count;
+    cluster_assign(config.stream_count, node_count, config.cluster_node, &state->cluster_first, &count);
+    state->cluster_state = (ClusterState){.view = CLUSTER_VIEW_DEFAULT, .fullscreen = -1, .camera_count = config.stream_count};
+    fprintf(stderr, "cluster: %s node %d of %d showing %d of %d cameras\n", config.cluster, config.cluster_node, node_count,
+            count, config.stream_count);
 
-    break;
+    for (int i = 0; i < count; i++)
+      config.streams[i] = config.streams[state->cluster_first + i];
+    config.stream_count = count;
   }
-  }
-}
-
-Command update_mpv_speed(int stream_i, double new_speed) {
-  if (state->streams[stream_i].speed == new_speed)
-    return 0;
-  fprintf(stderr, "%s: updating speed: %f -> %f\n", state->streams[stream_i].name, state->streams[stream_i].speed, new_speed);
-  state->streams[stream_i].speed = new_speed;
-  state->streams[stream_i].speed_updated_at = time_now();
-  return COMMAND_SYNC_SPEED;
-}
 
-Command reload_mpv(int stream_i) {
-  state->streams[stream_i].pinged_at = time_now();
-  return COMMAND_SYNC_MPV;
-}
-
-Command reload_layout_file() {
-  if (!state->layout_file_path)
-    return 0;
-  if (layout_file_reload(&state->layout_file, state->layout_file_path) < 0) {
-    fprintf(stderr, "failed to load layout '%s'\n", state->layout_file_path);
-    return 0;
+  // Create all windows while the key map is in flight
+  uint32_t window_values[] = {BORDER_COLOR, XCB_EVENT_MASK_BUTTON_PRESS | XCB_EVENT_MASK_ENTER_WINDOW};
+  for (int stream_i = 0; stream_i < config.stream_count; stream_i++) {
+    xcb_window_t window = xcb_generate_id(connection);
+    xcb_create_window(connection, XCB_COPY_FROM_PARENT, window, state->window, 0, 0, 1, 1, BORDER_WIDTH,
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
+                      XCB_CW_BORDER_PIXEL | XCB_CW_EVENT_MASK, window_values);
+    state->streams[stream_i].window = window;
+    state->streams[stream_i].name = config.streams[stream_i].name;
   }
-  fprintf(stderr, "reloaded layout file: %s\n", state->layout_file_path);
-  return COMMAND_SYNC_X11;
-}
 
-void load_config(Config config) {
-  // Load key map
+  state->x11_round_trips++;
+  xcb_get_keyboard_mapping_reply_t *mapping = xcb_get_keyboard_mapping_reply(connection, mapping_cookie, NULL);
+  if (mapping == NULL)
+    die("failed to get keyboard mapping");
   for (int i = 0; i < MAX_KEYBINDINGS; i++) {
-    state->key_map.quit[i] = XKeysymToKeycode(display, config.key_map.quit[i]);
-    state->key_map.home[i] = XKeysymToKeycode(display, config.key_map.home[i]);
-    state->key_map.next[i] = XKeysymToKeycode(display, config.key_map.next[i]);
-    state->key_map.previous[i] = XKeysymToKeycode(display, config.key_map.previous[i]);
-    state->key_map.reload[i] = XKeysymToKeycode(display, config.key_map.reload[i]);
+    state->key_map.quit[i] = keysym_to_keycode(mapping, config.key_map.quit[i]);
+    state->key_map.home[i] = keysym_to_keycode(mapping, config.key_map.home[i]);
+    state->key_map.next[i] = keysym_to_keycode(mapping, config.key_map.next[i]);
+    state->key_map.previous[i] = keysym_to_keycode(mapping, config.key_map.previous[i]);
+    state->key_map.reload[i] = keysym_to_keycode(mapping, config.key_map.reload[i]);
+    state->key_map.replay[i] = keysym_to_keycode(mapping, config.key_map.replay[i]);
+    state->key_map.overlay[i] = keysym_to_keycode(mapping, config.key_map.overlay[i]);
+    state->key_map.trace[i] = keysym_to_keycode(mapping, config.key_map.trace[i]);
   }
+  free(mapping);
+
+  // mpv connects to the X server on its own, so the windows must exist before it is handed their IDs
+  x11_sync();
 
   // Load layout
   if (config.layout_file) {
@@ -390,42 +478,46 @@ void load_config(Config config) {
     fprintf(stderr, "loading layout file: %s\n", state->layout_file.name);
   }
 
+  // Load replay
+  state->replay_seconds = config.replay_seconds > 0 ? config.replay_seconds : 30;
+  load_replay_quotas(config);
+
+  // Load memory budget
+  state->memory_budget = MAX(config.memory_budget, 0) * MIB;
+  state->memory_reported_at = view_now();
+
+  // Load stats
+  state->stats_interval_ms = MAX(config.stats_interval, 0);
+  state->stats_reported_at = state->now_ms;
+
+  // Load CPU topology
+  if (config.cpu_affinity) {
+    state->cpu = calloc(1, sizeof(CpuTopology));
+    if (cpu_topology_load(state->cpu) < 0) {
+      fprintf(stderr, "cpu: failed to read topology\n");
+      free(state->cpu);
+      state->cpu = NULL;
+    } else {
+      fprintf(stderr, "cpu: %d cpus, %d cores for streams\n", state->cpu->cpu_count, state->cpu->core_count);
+    }
+  }
+
   // Load streams
+  player_config = config;
+  state->create_player = create_player;
+  state->isolate = config.isolate;
+  state->auto_layout = config.auto_layout;
+  for (int i = 0; i < MAX_STREAMS; i++)
+    state->layout_order[i] = i;
   state->stream_count = config.stream_count;
   for (int stream_i = 0; stream_i < config.stream_count; stream_i++) {
-    Window window = XCreateSimpleWindow(display, state->window, 0, 0, 1, 1, BORDER_WIDTH, BORDER_COLOR, 0);
-    XSelectInput(display, window, ButtonPressMask | EnterWindowMask);
-    XSync(display, 0);
-    mpv_handle *mpv = mpv_create();
-
-    if (mpv == NULL)
-      die("failed to create mpv context");
-
-    mpv_set_option(mpv, "wid", MPV_FORMAT_INT64, &window);
-    // mpv_set_option_string(mpv, "idle", "yes");
-    // mpv_set_option_string(mpv, "force-window", "yes");
-    mpv_set_option_string(mpv, "profile", "low-latency");
-    mpv_set_option_string(mpv, "cache", "now");
-    mpv_set_option_string(mpv, "input-cursor", "no"); // FIXME: this causes the cursor disappears on a sub window when alt-tab is pressed, it only happens to sub window the cursor is hovering
-    mpv_set_option_string(mpv, "ao", "null");         // FIXME: audio other than null causes crashes when started with startx
-
-    // Apply global and scoped options
-    ConfigMpvFlags options = {};
-    config_unique_merge_mpv_flags(&options, config.mpv_flags);
-    config_unique_merge_mpv_flags(&options, config.streams[stream_i].mpv_flags);
-    apply_mpv_flags_option(mpv, options);
-
-    mpv_observe_property(mpv, 0, MPV_PROPERTY_TIME_REMAINING, MPV_FORMAT_DOUBLE);
-    mpv_observe_property(mpv, 0, MPV_PROPERTY_DEMUXER_CACHE_TIME, MPV_FORMAT_DOUBLE);
-
-    if (mpv_initialize(mpv) < 0)
-      die("failed to init mpv");
-
-    mpv_request_log_messages(mpv, "info");
+    if (state->cpu) {
+      char list[256];
+      state->streams[stream_i].cpus = cpu_stream_cpus(state->cpu, stream_i, config.stream_count);
+      fprintf(stderr, "%s: cpu: pinned to cpus %s\n", state->streams[stream_i].name,
+              cpu_format(&state->streams[stream_i].cpus, list, sizeof(list)));
+    }
 
-    state->streams[stream_i].name = config.streams[stream_i].name;
-    state->streams[stream_i].window = window;
-    state->streams[stream_i].mpv = mpv;
     state->streams[stream_i].main = config.streams[stream_i].main == 0
                                         ? config.streams[stream_i].sub
                                         : config.streams[stream_i].main;
@@ -433,8 +525,8 @@ void load_config(Config config) {
                                        ? config.streams[stream_i].main
                                        : config.streams[stream_i].sub;
     state->streams[stream_i].speed = 1.0;
-    state->streams[stream_i].speed_updated_at = time_now();
-    state->streams[stream_i].pinged_at = time_now();
+    state->streams[stream_i].speed_updated_at = view_now();
+    state->streams[stream_i].pinged_at = view_now();
 
     config_unique_merge_mpv_flags(&state->streams[stream_i].main_mpv_flags, config.main_mpv_flags);
     config_unique_merge_mpv_flags(&state->streams[stream_i].main_mpv_flags, config.streams[stream_i].main_mpv_flags);
@@ -442,133 +534,181 @@ void load_config(Config config) {
     config_unique_merge_mpv_flags(&state->streams[stream_i].sub_mpv_flags, config.sub_mpv_flags);
     config_unique_merge_mpv_flags(&state->streams[stream_i].sub_mpv_flags, config.streams[stream_i].sub_mpv_flags);
   }
+
+  // Player processes are forked by a helper started while this process has
+  // no threads yet, forking later could copy a lock held by another thread
+  if (state->isolate)
+    child_spawner_start(create_child_mpv);
+
+  // Load thumbnail pool
+#ifdef THUMBS
+  if (config.thumb_height > 0) {
+    // Decoding runs on the stream cores, like mpv's decoder threads
+    if (state->cpu) {
+      cpu_set_t cpus = cpu_all_stream_cpus(state->cpu);
+      cpu_pin_thread(&cpus);
+    }
+    state->thumb_height = config.thumb_height;
+    state->thumb_pool = pool_new(config.thumb_threads);
+    thumb_completion = player_thumb_completion_type(connection);
+    fprintf(stderr, "thumbnails: panes up to %dpx high decoded on %d threads\n", state->thumb_height, pool_thread_count(state->thumb_pool));
+  }
+#else
+  if (config.thumb_height > 0)
+    fprintf(stderr, "thumbnails: built without THUMBS=1, thumb-height is ignored\n");
+#endif
+
+  // Load activity pool, child processes shrink their screenshots themselves
+  if (state->auto_layout && !state->isolate)
+    state->activity_pool = pool_new(ACTIVITY_THREADS);
+
+  // Load players
+  for (int stream_i = 0; stream_i < config.stream_count; stream_i++) {
+    if (state->thumb_pool) {
+#ifdef THUMBS
+      state->streams[stream_i].thumb_player = player_thumb_new(state->streams[stream_i].name, connection,
+                                                               state->streams[stream_i].window, screen->root_depth, state->thumb_pool);
+#endif
+    } else {
+      full_player(stream_i);
+    }
+  }
+
+  // Keep the main loop away from the decoders
+  if (state->cpu) {
+    char list[256];
+    cpu_pin_thread(&state->cpu->main_cpus);
+    fprintf(stderr, "cpu: main loop pinned to cpus %s\n", cpu_format(&state->cpu->main_cpus, list, sizeof(list)));
+  }
 }
 
+#ifdef THUMBS
+static void thumb_completed(xcb_shm_completion_event_t *event) {
+  for (int i = 0; i < state->stream_count; i++)
+    if (state->streams[i].window == event->drawable && state->streams[i].thumb_player)
+      player_thumb_completed(state->streams[i].thumb_player, event);
+}
+#endif
+
 void run() {
-  sync_x11();
+  fprintf(stderr, "xcb: started with %d round trips\n", state->x11_round_trips);
+  TRACE_THREAD("main");
+  signal(SIGUSR1, request_trace);
 
-  for (int i = 0; i < state->stream_count; i++)
-    sync_mpv(i);
+  view_start();
 
   clock_set_fps(60);
 
   while (True) {
     clock_start();
+    TRACE_BEGIN("frame", NULL);
+    state->now_ms = time_now_ms();
 
     Command root_command = 0;
 
     // X11 events
-    while (XPending(display)) {
-      XEvent event;
-      XNextEvent(display, &event);
-      switch (event.type) {
-      case ClientMessage:
-        if (event.xclient.data.l[0] == wm_delete_window)
+    if (xcb_connection_has_error(connection)) {
+      fprintf(stderr, "xcb: connection to display lost\n");
+      return;
+    }
+
+    TRACE_BEGIN("x11 events", NULL);
+    xcb_generic_event_t *event;
+    while ((event = xcb_poll_for_event(connection))) {
+      switch (event->response_type & ~0x80) {
+      case 0:
+        on_x11_error((xcb_generic_error_t *)event);
+        break;
+      case XCB_CLIENT_MESSAGE:
+        if (((xcb_client_message_event_t *)event)->data.data32[0] == wm_delete_window) {
+          free(event);
           return;
+        }
         break;
-      case EnterNotify:
-        root_command |= activate_window(event.xany.window);
+      case XCB_ENTER_NOTIFY:
+        root_command |= activate_window(((xcb_enter_notify_event_t *)event)->event);
         break;
-      case KeyPress: {
-        // fprintf(stderr, "KeyPress: %d\n", event.xkey.keycode);
+      case XCB_KEY_PRESS: {
+        xcb_key_press_event_t *key = (xcb_key_press_event_t *)event;
+        // fprintf(stderr, "KeyPress: %d\n", key->detail);
         for (int key_i = 0; key_i < MAX_KEYBINDINGS; key_i++) {
-          if (event.xkey.keycode == state->key_map.quit[key_i]) {
+          if (key->detail == state->key_map.quit[key_i]) {
+            free(event);
             return;
-          } else if (event.xkey.keycode == state->key_map.home[key_i]) {
-            root_command |= toggle_fullscreen(0);
-          } else if (event.xkey.keycode == state->key_map.next[key_i]) {
-            root_command |= go_next();
-          } else if (event.xkey.keycode == state->key_map.previous[key_i]) {
-            root_command |= go_previous();
-          } else if (event.xkey.keycode == state->key_map.reload[key_i]) {
-            root_command |= reload_layout_file();
+          } else if (key->detail == state->key_map.home[key_i]) {
+            root_command |= state->cluster.role ? cluster_toggle_fullscreen(0) : toggle_fullscreen(0);
+          } else if (key->detail == state->key_map.next[key_i]) {
+            root_command |= state->cluster.role ? cluster_go(1) : go_next();
+          } else if (key->detail == state->key_map.previous[key_i]) {
+            root_command |= state->cluster.role ? cluster_go(-1) : go_previous();
+          } else if (key->detail == state->key_map.reload[key_i]) {
+            root_command |= state->cluster.role ? cluster_reload_layout_file() : reload_layout_file();
+          } else if (key->detail == state->key_map.replay[key_i]) {
+            root_command |= start_replay();
+          } else if (key->detail == state->key_map.overlay[key_i]) {
+            root_command |= toggle_overlay();
+          } else if (key->detail == state->key_map.trace[key_i]) {
+            trace_requested = 1;
           } else {
             continue;
           }
           break;
         }
         break;
-      case ConfigureNotify:
-        if (event.xconfigure.window == state->window) {
-          root_command |= update_size(event.xconfigure.width, event.xconfigure.height);
-        } else {
-          // Assume this is the root window
-          XWindowChanges changes = {.x = 0,
-                                    .y = 0,
-                                    .width = event.xconfigure.width,
-                                    .height = event.xconfigure.height};
-          XConfigureWindow(display, state->window, CWX | CWY | CWWidth | CWHeight, &changes);
+      }
+      case XCB_CONFIGURE_NOTIFY: {
+        xcb_configure_notify_event_t *configure = (xcb_configure_notify_event_t *)event;
+        if (configure->window == state->window) {
+          root_command |= update_size(configure->width, configure->height);
+        } else if (configure->window == screen->root) {
+          x11_configure_window(state->window, 0, 0, configure->width, configure->height, 0);
+          xcb_flush(connection);
         }
         break;
-      case ButtonPress:
-        // fprintf(stderr, "ButtonPress: %u\n", event.xbutton.button);
-        root_command |= toggle_fullscreen(event.xbutton.window);
+      }
+      case XCB_BUTTON_PRESS:
+        // fprintf(stderr, "ButtonPress: %u\n", ((xcb_button_press_event_t *)event)->detail);
+        if (state->cluster.role)
+          root_command |= cluster_toggle_fullscreen(((xcb_button_press_event_t *)event)->event);
+        else
+          root_command |= toggle_fullscreen(((xcb_button_press_event_t *)event)->event);
+        break;
+#ifdef THUMBS
+      default:
+        if (thumb_completion && (event->response_type & ~0x80) == thumb_completion)
+          thumb_completed((xcb_shm_completion_event_t *)event);
         break;
+#endif
         // default:
-        //   fprintf(stderr, "unhandled X11 event: %d\n", event.type);
-      }
+        //   fprintf(stderr, "unhandled X11 event: %d\n", event->response_type);
       }
+      free(event);
     }
+    TRACE_END();
 
-    for (int stream_i = 0; stream_i < state->stream_count; stream_i++) {
-      Command sub_command = root_command;
-
-      // Reload locked up stream
-      if (is_mpv_playing(stream_i) && time_now() > (state->streams[stream_i].pinged_at + MPV_TIMEOUT_SEC))
-        sub_command |= reload_mpv(stream_i);
-
-      // Reset speed if stuck
-      if (time_now() > state->streams[stream_i].speed_updated_at + MPV_TIMEOUT_SEC)
-        sub_command |= update_mpv_speed(stream_i, 1.0);
-
-      // mpv events
-      while (True) {
-        mpv_event *mp_event = mpv_wait_event(state->streams[stream_i].mpv, 0);
-        if (mp_event->event_id == MPV_EVENT_NONE)
-          break;
-        if (mp_event->event_id == MPV_EVENT_SHUTDOWN)
-          return;
-        if (mp_event->event_id == MPV_EVENT_LOG_MESSAGE) {
-          mpv_event_log_message *msg = mp_event->data;
-          fprintf(stderr, "%s: %s", state->streams[stream_i].name, msg->text);
-          continue;
-        }
-        if (mp_event->event_id == MPV_EVENT_PROPERTY_CHANGE) {
-          mpv_event_property *property = mp_event->data;
-          if (strcmp(property->name, MPV_PROPERTY_TIME_REMAINING)) {
-            double *data = property->data;
-            if (data) {
-              state->streams[stream_i].pinged_at = time_now();
-              // fprintf(stderr, "property: %s: %f\n", MPV_PROPERTY_TIME_REMAINING, *data);
-            }
-          } else if (strcmp(property->name, MPV_PROPERTY_DEMUXER_CACHE_TIME)) {
-            double *data = property->data;
-            if (data) {
-              // fprintf(stderr, "property: %s: %f\n", MPV_PROPERTY_DEMUXER_CACHE_TIME, *data);
-
-              if (*data > MPV_MAX_DELAY_SEC) {
-                sub_command |= update_mpv_speed(stream_i, 1.5);
-              } else if (*data < MPV_MIN_DISPLAY_SEC) {
-                sub_command |= update_mpv_speed(stream_i, 1.0);
-              }
-            }
-          }
-          continue;
-        }
-        // fprintf(stderr, "%s: unhandled mpv event: %s\n", state->streams[stream_i].name, mpv_event_name(mp_event->event_id));
-      }
+    if (trace_requested) {
+      dump_trace();
+      trace_requested = 0;
+    }
 
-      // mpv side effects
-      if (sub_command & COMMAND_SYNC_MPV)
-        sync_mpv(stream_i);
-      if (sub_command & COMMAND_SYNC_SPEED)
-        sync_mpv_speed(stream_i);
+    // Cluster view is applied in the frame it arrives
+    if (state->cluster.role == CLUSTER_LEADER) {
+      cluster_heartbeat(&state->cluster, &state->cluster_state, time_now_ms());
+    } else if (state->cluster.role == CLUSTER_FOLLOWER) {
+      ClusterState received;
+      if (cluster_receive(&state->cluster, &received))
+        root_command |= apply_cluster(received);
     }
 
-    // X11 side effects
-    if (root_command & COMMAND_SYNC_X11)
-      sync_x11();
+    // Restart crashed player processes
+    for (int i = 0; i < state->stream_count; i++)
+      if (state->streams[i].child && child_supervise(state->streams[i].child))
+        state->stream_commands[i] |= reload_mpv(i) | COMMAND_SYNC_SPEED;
+
+    if (view_update(root_command) < 0)
+      return;
 
+    TRACE_END();
     clock_wait();
   }
 }
@@ -583,6 +723,9 @@ int main(int argc, const char *argv[]) {
               .next[MAX_KEYBINDINGS - 1] = XStringToKeysym("l"),
               .previous[MAX_KEYBINDINGS - 1] = XStringToKeysym("h"),
               .reload[MAX_KEYBINDINGS - 1] = XStringToKeysym("r"),
+              .replay[MAX_KEYBINDINGS - 1] = XStringToKeysym("BackSpace"),
+              .overlay[MAX_KEYBINDINGS - 1] = XStringToKeysym("i"),
+              .trace[MAX_KEYBINDINGS - 1] = XStringToKeysym("t"),
           },
   };
 
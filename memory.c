@@ -0,0 +1,49 @@
+#include "memory.h"
+#include "util.h"
+
+// Share of the budget each role gets relative to the others
+static const int ROLE_WEIGHTS[] = {
+    [MEMORY_ROLE_STOPPED] = 0,
+    [MEMORY_ROLE_STANDBY] = 1,
+    [MEMORY_ROLE_PANE] = 4,
+    [MEMORY_ROLE_FULLSCREEN] = 16,
+};
+
+static const char *ROLE_NAMES[] = {
+    [MEMORY_ROLE_STOPPED] = "stopped",
+    [MEMORY_ROLE_STANDBY] = "standby",
+    [MEMORY_ROLE_PANE] = "pane",
+    [MEMORY_ROLE_FULLSCREEN] = "fullscreen",
+};
+
+// Enough for a few seconds of a sub stream, a stream gets less only when the budget is too small
+static const int64_t MIN_BYTES = 1024 * 1024;
+// Below this the demuxer can not hold a single keyframe of a sub stream
+static const int64_t FLOOR_BYTES = 256 * 1024;
+// Default of demuxer-max-bytes, more than this is never used by a live stream
+static const int64_t MAX_BYTES = 150 * 1024 * 1024;
+
+int64_t memory_assign(int64_t budget, const MemoryRole roles[], const int64_t back_bytes[], int count, MemoryLimits limits[]) {
+  // Back buffers hold replay data, they are reserved first
+  int64_t remaining = budget;
+  int weights = 0;
+  for (int i = 0; i < count; i++) {
+    remaining -= back_bytes[i];
+    weights += ROLE_WEIGHTS[roles[i]];
+  }
+
+  // The per-stream minimum shrinks when it does not fit, down to what a demuxer needs
+  int64_t min_bytes = count ? MIN(MIN_BYTES, MAX(remaining / count, FLOOR_BYTES)) : MIN_BYTES;
+  remaining = MAX(remaining - min_bytes * count, 0);
+
+  int64_t total = 0;
+  for (int i = 0; i < count; i++) {
+    int64_t share = weights ? remaining * ROLE_WEIGHTS[roles[i]] / weights : 0;
+    limits[i].max_bytes = MIN(min_bytes + share, MAX_BYTES);
+    limits[i].max_back_bytes = back_bytes[i];
+    total += limits[i].max_bytes + limits[i].max_back_bytes;
+  }
+  return MAX(total - budget, 0);
+}
+
+const char *memory_role_name(MemoryRole role) { return ROLE_NAMES[role]; }
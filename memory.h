@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+
+typedef enum {
+  MEMORY_ROLE_STOPPED,
+  MEMORY_ROLE_STANDBY,
+  MEMORY_ROLE_PANE,
+  MEMORY_ROLE_FULLSCREEN,
+} MemoryRole;
+
+typedef struct {
+  int64_t max_bytes;      // demuxer-max-bytes
+  int64_t max_back_bytes; // demuxer-max-back-bytes
+} MemoryLimits;
+
+// Returns by how many bytes the limits exceed the budget, 0 when they fit.
+int64_t memory_assign(int64_t budget, const MemoryRole roles[], const int64_t back_bytes[], int count, MemoryLimits limits[]);
+
+const char *memory_role_name(MemoryRole role);
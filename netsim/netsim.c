@@ -0,0 +1,489 @@
+#include <arpa/inet.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+// TCP proxy that sits between camviewport and local test streams and injects
+// scripted latency, jitter, stalls, bandwidth caps and disconnects.
+//
+// Events are written to stderr and a summary per route to stdout, both as
+// JSON lines.
+
+#define MAX_ROUTES 32
+#define MAX_CONNECTIONS 256
+#define MAX_STEPS 256
+#define MAX_QUEUE_BYTES (64 * 1024 * 1024)
+#define CHUNK_SIZE 16384
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+typedef struct Chunk {
+  struct Chunk *next;
+  int64_t received_at;
+  int64_t release_at;
+  int size;
+  int offset;
+  char data[CHUNK_SIZE];
+} Chunk;
+
+typedef struct {
+  Chunk *head;
+  Chunk *tail;
+  int64_t queued;
+  int64_t tokens;
+  int64_t refilled_at;
+} Pipe;
+
+typedef struct {
+  int route;
+  int id;
+  int client;
+  int upstream;
+  // 0 is client to upstream, 1 is upstream to client
+  Pipe pipes[2];
+} Connection;
+
+typedef struct {
+  int port;
+  struct sockaddr_in upstream;
+  int fd;
+  int connections;
+  int64_t bytes;
+  // Longest time data was held by the proxy, not what camviewport shows
+  int64_t max_queue_ms;
+} Route;
+
+typedef struct {
+  int64_t at_ms;
+  char action[32];
+  int value;
+} Step;
+
+static Route routes[MAX_ROUTES];
+static int route_count;
+static Connection *connections[MAX_CONNECTIONS];
+static int connection_ids;
+static Step steps[MAX_STEPS];
+static int step_count;
+
+static int latency_ms;
+static int jitter_ms;
+static int bandwidth_kbps;
+static int64_t hold_until;
+
+static int64_t started_at;
+
+static int64_t time_now_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000 - started_at;
+}
+
+static void die(const char *msg) {
+  perror(msg);
+  exit(1);
+}
+
+static void log_event(const char *event, int route, int connection, int64_t value) {
+  fprintf(stderr, "{\"t\":%lld,\"event\":\"%s\",\"route\":%d,\"connection\":%d,\"value\":%lld}\n",
+          (long long)time_now_ms(), event, route, connection, (long long)value);
+}
+
+static void set_nonblocking(int fd) {
+  fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+  int one = 1;
+  setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+}
+
+static void parse_route(const char *arg) {
+  if (route_count == MAX_ROUTES) {
+    fprintf(stderr, "too many routes\n");
+    exit(1);
+  }
+
+  char host[64];
+  int port, upstream_port;
+  if (sscanf(arg, "%d=%63[^:]:%d", &port, host, &upstream_port) != 3) {
+    fprintf(stderr, "invalid route '%s', expected port=host:port\n", arg);
+    exit(1);
+  }
+
+  Route *route = &routes[route_count++];
+  route->port = port;
+  route->upstream.sin_family = AF_INET;
+  route->upstream.sin_port = htons(upstream_port);
+  if (inet_pton(AF_INET, host, &route->upstream.sin_addr) != 1) {
+    fprintf(stderr, "invalid upstream host '%s'\n", host);
+    exit(1);
+  }
+}
+
+// Each line is "<seconds> <action> [value]", lines starting with # are
+// ignored and so are the expect lines read by scenario.sh.
+static void parse_scenario(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (!file)
+    die(path);
+
+  char line[256];
+  while (fgets(line, sizeof(line), file)) {
+    if (line[0] == '#' || line[0] == '\n' || strncmp(line, "expect ", 7) == 0)
+      continue;
+    if (step_count == MAX_STEPS) {
+      fprintf(stderr, "too many steps\n");
+      exit(1);
+    }
+
+    double at;
+    Step *step = &steps[step_count];
+    int fields = sscanf(line, "%lf %31s %d", &at, step->action, &step->value);
+    if (fields < 2) {
+      fprintf(stderr, "invalid scenario line: %s", line);
+      exit(1);
+    }
+    step->at_ms = at * 1000;
+    step_count++;
+  }
+  fclose(file);
+}
+
+static void pipe_free(Pipe *pipe) {
+  while (pipe->head) {
+    Chunk *next = pipe->head->next;
+    free(pipe->head);
+    pipe->head = next;
+  }
+  pipe->tail = NULL;
+  pipe->queued = 0;
+}
+
+static void connection_close(int index, const char *reason) {
+  Connection *connection = connections[index];
+  log_event(reason, connection->route, connection->id, 0);
+  close(connection->client);
+  close(connection->upstream);
+  pipe_free(&connection->pipes[0]);
+  pipe_free(&connection->pipes[1]);
+  free(connection);
+  connections[index] = NULL;
+}
+
+static void accept_connection(int route_i) {
+  Route *route = &routes[route_i];
+  int client = accept(route->fd, NULL, NULL);
+  if (client < 0)
+    return;
+
+  int upstream = socket(AF_INET, SOCK_STREAM, 0);
+  if (upstream < 0 || connect(upstream, (struct sockaddr *)&route->upstream, sizeof(route->upstream)) < 0) {
+    log_event("upstream_failed", route_i, -1, errno);
+    close(client);
+    if (upstream >= 0)
+      close(upstream);
+    return;
+  }
+
+  int index = 0;
+  while (index < MAX_CONNECTIONS && connections[index])
+    index++;
+  if (index == MAX_CONNECTIONS) {
+    close(client);
+    close(upstream);
+    return;
+  }
+
+  set_nonblocking(client);
+  set_nonblocking(upstream);
+
+  Connection *connection = calloc(1, sizeof(Connection));
+  connection->route = route_i;
+  connection->id = connection_ids++;
+  connection->client = client;
+  connection->upstream = upstream;
+  connections[index] = connection;
+
+  route->connections++;
+  log_event(route->connections > 1 ? "reconnect" : "connect", route_i, connection->id, route->connections - 1);
+}
+
+// Reads from one side and queues the data with the current latency.
+static int pipe_read(Connection *connection, int direction) {
+  int fd = direction == 0 ? connection->client : connection->upstream;
+  Pipe *pipe = &connection->pipes[direction];
+
+  Chunk *chunk = malloc(sizeof(Chunk));
+  ssize_t size = recv(fd, chunk->data, CHUNK_SIZE, 0);
+  if (size <= 0) {
+    free(chunk);
+    return size < 0 && errno == EAGAIN ? 0 : -1;
+  }
+
+  int64_t now = time_now_ms();
+  chunk->next = NULL;
+  chunk->received_at = now;
+  chunk->release_at = now + latency_ms + (jitter_ms > 0 ? rand() % (jitter_ms + 1) : 0);
+  chunk->size = size;
+  chunk->offset = 0;
+
+  // TCP never reorders, so jitter can only delay behind the previous chunk
+  if (pipe->tail) {
+    chunk->release_at = MAX(chunk->release_at, pipe->tail->release_at);
+    pipe->tail->next = chunk;
+  } else {
+    pipe->head = chunk;
+  }
+  pipe->tail = chunk;
+  pipe->queued += size;
+  return 0;
+}
+
+static int64_t pipe_budget(Pipe *pipe, int64_t now) {
+  if (bandwidth_kbps <= 0)
+    return INT64_MAX;
+
+  // Token bucket holding at most 100 ms worth of data
+  int64_t bytes_per_ms = MAX(bandwidth_kbps / 8, 1);
+  if (pipe->refilled_at == 0)
+    pipe->refilled_at = now;
+  pipe->tokens = MIN(pipe->tokens + (now - pipe->refilled_at) * bytes_per_ms, bytes_per_ms * 100);
+  pipe->refilled_at = now;
+  return pipe->tokens;
+}
+
+static int pipe_ready(Pipe *pipe, int64_t now) {
+  return pipe->head && pipe->head->release_at <= now && now >= hold_until;
+}
+
+// Writes released data to the other side.
+static int pipe_write(Connection *connection, int direction) {
+  int fd = direction == 0 ? connection->upstream : connection->client;
+  Pipe *pipe = &connection->pipes[direction];
+  Route *route = &routes[connection->route];
+  int64_t now = time_now_ms();
+
+  while (pipe_ready(pipe, now)) {
+    Chunk *chunk = pipe->head;
+    int64_t budget = pipe_budget(pipe, now);
+    if (budget <= 0)
+      return 0;
+
+    int64_t size = MIN(chunk->size - chunk->offset, budget);
+    ssize_t written = send(fd, &chunk->data[chunk->offset], size, MSG_NOSIGNAL);
+    if (written < 0)
+      return errno == EAGAIN ? 0 : -1;
+
+    if (bandwidth_kbps > 0)
+      pipe->tokens -= written;
+    chunk->offset += written;
+    pipe->queued -= written;
+
+    if (direction == 1) {
+      route->bytes += written;
+      route->max_queue_ms = MAX(route->max_queue_ms, now - chunk->received_at);
+    }
+
+    if (chunk->offset < chunk->size)
+      return 0;
+    pipe->head = chunk->next;
+    if (!pipe->head)
+      pipe->tail = NULL;
+    free(chunk);
+  }
+  return 0;
+}
+
+static int apply_step(Step *step) {
+  int64_t now = time_now_ms();
+  log_event(step->action, -1, -1, step->value);
+
+  if (strcmp(step->action, "latency") == 0) {
+    latency_ms = step->value;
+  } else if (strcmp(step->action, "jitter") == 0) {
+    jitter_ms = step->value;
+  } else if (strcmp(step->action, "bandwidth") == 0) {
+    bandwidth_kbps = step->value;
+  } else if (strcmp(step->action, "stall") == 0) {
+    // Data keeps being read but is released all at once when the stall ends
+    hold_until = now + step->value;
+  } else if (strcmp(step->action, "disconnect") == 0) {
+    for (int i = 0; i < MAX_CONNECTIONS; i++)
+      if (connections[i])
+        connection_close(i, "disconnect");
+  } else if (strcmp(step->action, "reset") == 0) {
+    latency_ms = 0;
+    jitter_ms = 0;
+    bandwidth_kbps = 0;
+    hold_until = 0;
+  } else if (strcmp(step->action, "end") == 0) {
+    return 1;
+  } else {
+    fprintf(stderr, "unknown action '%s'\n", step->action);
+    exit(1);
+  }
+  return 0;
+}
+
+static void listen_routes() {
+  for (int i = 0; i < route_count; i++) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd < 0)
+      die("socket");
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_port = htons(routes[i].port),
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) < 0)
+      die("bind");
+    if (listen(fd, 16) < 0)
+      die("listen");
+    set_nonblocking(fd);
+    routes[i].fd = fd;
+  }
+}
+
+static void print_summary() {
+  for (int i = 0; i < route_count; i++)
+    printf("{\"route\":%d,\"port\":%d,\"connections\":%d,\"reconnects\":%d,\"bytes\":%lld,"
+           "\"max_queue_ms\":%lld}\n",
+           i, routes[i].port, routes[i].connections, MAX(routes[i].connections - 1, 0),
+           (long long)routes[i].bytes, (long long)routes[i].max_queue_ms);
+  fflush(stdout);
+}
+
+static volatile sig_atomic_t stopped;
+
+static void on_signal(int signal) { stopped = 1; }
+
+static void usage(const char *name) {
+  fprintf(stderr, "usage: %s [-s scenario] [-S seed] port=host:port...\n", name);
+  exit(1);
+}
+
+int main(int argc, char *argv[]) {
+  int opt;
+  unsigned seed = 1;
+  while ((opt = getopt(argc, argv, "s:S:")) != -1) {
+    switch (opt) {
+    case 's':
+      parse_scenario(optarg);
+      break;
+    case 'S':
+      seed = atoi(optarg);
+      break;
+    default:
+      usage(argv[0]);
+    }
+  }
+  for (int i = optind; i < argc; i++)
+    parse_route(argv[i]);
+  if (route_count == 0)
+    usage(argv[0]);
+
+  // Same seed gives the same jitter so runs can be compared
+  srand(seed);
+  signal(SIGINT, on_signal);
+  signal(SIGTERM, on_signal);
+
+  started_at = time_now_ms();
+  listen_routes();
+
+  int next_step = 0;
+  struct pollfd fds[MAX_ROUTES + MAX_CONNECTIONS * 2];
+  int owners[MAX_ROUTES + MAX_CONNECTIONS * 2];
+
+  while (!stopped) {
+    int64_t now = time_now_ms();
+    while (next_step < step_count && steps[next_step].at_ms <= now)
+      if (apply_step(&steps[next_step++]))
+        goto end;
+
+    // Listeners first, then both sides of every connection
+    int count = 0;
+    for (int i = 0; i < route_count; i++) {
+      fds[count] = (struct pollfd){.fd = routes[i].fd, .events = POLLIN};
+      owners[count++] = -1;
+    }
+
+    int busy = 0;
+    for (int i = 0; i < MAX_CONNECTIONS; i++) {
+      Connection *connection = connections[i];
+      if (!connection)
+        continue;
+
+      // Stop reading when the queue is full so TCP pushes back on the sender
+      short client_events = 0, upstream_events = 0;
+      if (connection->pipes[0].queued < MAX_QUEUE_BYTES)
+        client_events |= POLLIN;
+      if (connection->pipes[1].queued < MAX_QUEUE_BYTES)
+        upstream_events |= POLLIN;
+      if (pipe_ready(&connection->pipes[0], now))
+        upstream_events |= POLLOUT;
+      if (pipe_ready(&connection->pipes[1], now))
+        client_events |= POLLOUT;
+      busy |= connection->pipes[0].head || connection->pipes[1].head;
+
+      fds[count] = (struct pollfd){.fd = connection->client, .events = client_events};
+      owners[count++] = i;
+      fds[count] = (struct pollfd){.fd = connection->upstream, .events = upstream_events};
+      owners[count++] = i;
+    }
+
+    // Wake up for queued data and the next step
+    int timeout = busy ? 2 : 100;
+    if (next_step < step_count)
+      timeout = MIN(timeout, MAX(steps[next_step].at_ms - now, 0));
+
+    if (poll(fds, count, timeout) < 0 && errno != EINTR)
+      die("poll");
+
+    for (int i = 0; i < count; i++) {
+      if (owners[i] < 0) {
+        if (fds[i].revents & POLLIN)
+          accept_connection(i);
+        continue;
+      }
+
+      Connection *connection = connections[owners[i]];
+      if (!connection || !fds[i].revents)
+        continue;
+
+      int is_client = fds[i].fd == connection->client;
+      int err = 0;
+      if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+        err |= pipe_read(connection, is_client ? 0 : 1);
+      if (!err && (fds[i].revents & POLLOUT))
+        err |= pipe_write(connection, is_client ? 1 : 0);
+      if (err)
+        connection_close(owners[i], is_client ? "client_closed" : "upstream_closed");
+    }
+
+    // Data released by time alone still has to be written
+    now = time_now_ms();
+    for (int i = 0; i < MAX_CONNECTIONS; i++)
+      for (int direction = 0; direction < 2 && connections[i]; direction++)
+        if (pipe_ready(&connections[i]->pipes[direction], now) && pipe_write(connections[i], direction) < 0)
+          connection_close(i, "write_failed");
+  }
+
+end:
+  print_summary();
+  for (int i = 0; i < MAX_CONNECTIONS; i++)
+    if (connections[i])
+      connection_close(i, "shutdown");
+  return 0;
+}
@@ -0,0 +1,117 @@
+#!/bin/sh
+# Runs camviewport under Xvfb against local test streams through netsim and
+# checks reconnects, reloads, latency excursions and catch-up per stream.
+# Latency and speed come from the stats camviewport logs, netsim only knows
+# how long it held data back itself.
+#
+# usage: netsim/scenario.sh <scenario> <rtsp url>...
+#
+# The urls must point at a local RTSP server, e.g. mediamtx with ffmpeg
+# publishing a test pattern, so the whole run stays offline.
+
+set -eu
+
+if [ $# -lt 2 ]; then
+  echo "usage: $0 <scenario> <rtsp url>..." >&2
+  exit 1
+fi
+
+SCENARIO=$1
+shift
+
+CAMVIEWPORT=${CAMVIEWPORT:-dist/camviewport_$(uname)_$(uname -m)}
+NETSIM=${NETSIM:-dist/netsim}
+OUT=${OUT:-dist/scenario/$(basename "$SCENARIO" .txt)}
+PROXY_PORT=${PROXY_PORT:-18554}
+DISPLAY_NUMBER=${DISPLAY_NUMBER:-99}
+STATS_INTERVAL_MS=${STATS_INTERVAL_MS:-250}
+# Latency above which camviewport speeds a stream up, MPV_MAX_DELAY_SEC
+LATENCY_THRESHOLD=${LATENCY_THRESHOLD:-0.5}
+
+# Defaults for the limits, a scenario sets its own with lines like
+# "expect max_latency_ms 9000"
+MAX_RECONNECTS=${MAX_RECONNECTS:-5}
+MAX_RELOADS=${MAX_RELOADS:-5}
+MAX_LATENCY_MS=${MAX_LATENCY_MS:-5000}
+MAX_EXCURSION_MS=${MAX_EXCURSION_MS:-10000}
+eval "$(awk '$1 == "expect" && $2 ~ /^max_[a-z_]+$/ && $3 ~ /^[0-9]+$/ { printf "%s=%s\n", toupper($2), $3 }' "$SCENARIO")"
+
+mkdir -p "$OUT"
+: >"$OUT/camviewport.ini"
+echo "mpv-rtsp-transport = tcp" >>"$OUT/camviewport.ini"
+echo "stats-interval = $STATS_INTERVAL_MS" >>"$OUT/camviewport.ini"
+
+# Route every stream through its own proxy port
+routes=""
+i=0
+for url in "$@"; do
+  upstream=$(echo "$url" | sed -E 's|^rtsp://([^/@]*@)?([^/:]+):?([0-9]*).*|\2:\3|; s|:$|:554|')
+  port=$((PROXY_PORT + i))
+  routes="$routes $port=$upstream"
+  printf '[CAM-%02d]\nsub = %s\n' "$i" "$(echo "$url" | sed -E "s|^(rtsp://([^/@]*@)?)[^/]+|\\1127.0.0.1:$port|")" >>"$OUT/camviewport.ini"
+  i=$((i + 1))
+done
+
+Xvfb ":$DISPLAY_NUMBER" -screen 0 1920x1080x24 >"$OUT/xvfb.log" 2>&1 &
+xvfb=$!
+trap 'kill $xvfb 2>/dev/null || true' EXIT
+sleep 1
+
+# shellcheck disable=SC2086
+"$NETSIM" -s "$SCENARIO" $routes >"$OUT/summary.jsonl" 2>"$OUT/events.jsonl" &
+netsim=$!
+
+DISPLAY=":$DISPLAY_NUMBER" "$CAMVIEWPORT" -config "$OUT/camviewport.ini" 2>"$OUT/camviewport.log" &
+camviewport=$!
+
+# The scenario ends with an end step which stops netsim
+wait $netsim || true
+kill $camviewport 2>/dev/null || true
+wait $camviewport 2>/dev/null || true
+
+# Prints the samples, the highest latency in ms, the longest excursion above
+# the threshold in ms, the final speed and whether the stream caught up, i.e.
+# ended at normal speed below the threshold. An excursion runs from the first
+# sample above the threshold to the last one before it drops back.
+stats() {
+  awk -v name="$1:" -v threshold="$LATENCY_THRESHOLD" '
+    $1 == name && $2 == "stats:" {
+      samples++
+      t = $4; latency = $6; speed = $8
+      if (latency > max) max = latency
+      if (latency <= threshold) { above = 0; next }
+      if (!above) since = t
+      above = 1
+      if (t - since > excursion) excursion = t - since
+    }
+    END {
+      printf "%d %d %d %.2f %s\n", samples, max * 1000, excursion, speed,
+        (samples > 0 && speed == 1 && latency <= threshold) ? "true" : "false"
+    }' "$OUT/camviewport.log"
+}
+
+failed=0
+: >"$OUT/results.jsonl"
+i=0
+for url in "$@"; do
+  name=$(printf 'CAM-%02d' "$i")
+  summary=$(grep "\"route\":$i," "$OUT/summary.jsonl" || echo "{}")
+  reconnects=$(echo "$summary" | sed -nE 's/.*"reconnects":([0-9]+).*/\1/p')
+  reloads=$(grep -c "^$name: reloading stream" "$OUT/camviewport.log" || true)
+  read -r samples latency excursion speed caught_up <<EOF
+$(stats "$name")
+EOF
+
+  ok=true
+  [ "${reconnects:-0}" -le "$MAX_RECONNECTS" ] || ok=false
+  [ "$reloads" -le "$MAX_RELOADS" ] || ok=false
+  [ "$latency" -le "$MAX_LATENCY_MS" ] || ok=false
+  [ "$excursion" -le "$MAX_EXCURSION_MS" ] || ok=false
+  [ "$caught_up" = "true" ] || ok=false
+  [ "$ok" = "true" ] || failed=1
+
+  echo "{\"stream\":\"$name\",\"reconnects\":${reconnects:-0},\"reloads\":$reloads,\"samples\":$samples,\"max_latency_ms\":$latency,\"max_excursion_ms\":$excursion,\"final_speed\":$speed,\"caught_up\":$caught_up,\"ok\":$ok}" | tee -a "$OUT/results.jsonl"
+  i=$((i + 1))
+done
+
+exit $failed
@@ -0,0 +1,76 @@
+#include "player.h"
+#include "trace.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+Player *player_new(const PlayerBackend *backend, const char *name, void *handle) {
+  Player *player = calloc(1, sizeof(Player));
+  if (player == NULL)
+    die("failed to allocate player");
+  player->backend = backend;
+  player->name = name;
+  player->handle = handle;
+  return player;
+}
+
+int player_command(Player *player, const char **args) {
+  TRACE_BEGIN(args[0], player->name);
+  int err = player->backend->command(player, args);
+  TRACE_END();
+  return err;
+}
+
+int player_command_async(Player *player, const char **args) {
+  TRACE_BEGIN(args[0], player->name);
+  int err = player->backend->command_async(player, args);
+  TRACE_END();
+  return err;
+}
+
+int player_set_property_string(Player *player, const char *name, const char *data) {
+  TRACE_BEGIN(name, player->name);
+  int err = player->backend->set_property_string(player, name, data);
+  TRACE_END();
+  return err;
+}
+
+mpv_event *player_wait_event(Player *player) {
+  return player->backend->wait_event(player);
+}
+
+void player_destroy(Player *player) {
+  player->backend->destroy(player);
+  free(player);
+}
+
+void player_loadfile(Player *player, const char *stream) {
+  const char *cmd[] = {"loadfile", stream, NULL};
+  int err = player_command(player, cmd);
+  if (err < 0)
+    fprintf(stderr, "%s: failed to play file: %d\n", player->name, err);
+}
+
+void player_stop(Player *player) {
+  const char *cmd[] = {"stop", NULL};
+  int err = player_command(player, cmd);
+  if (err < 0)
+    fprintf(stderr, "%s: failed to stop file: %d\n", player->name, err);
+}
+
+void player_seek(Player *player, double target, const char *flags) {
+  char target_str[32];
+  snprintf(target_str, sizeof(target_str), "%f", target);
+  const char *cmd[] = {"seek", target_str, flags, NULL};
+  int err = player_command(player, cmd);
+  if (err < 0)
+    fprintf(stderr, "%s: failed to seek: %d\n", player->name, err);
+}
+
+void player_set_speed(Player *player, double speed) {
+  char speed_str[32];
+  snprintf(speed_str, sizeof(speed_str), "%f", speed);
+  int err = player_set_property_string(player, "speed", speed_str);
+  if (err < 0)
+    fprintf(stderr, "%s: failed to set speed: %d\n", player->name, err);
+}
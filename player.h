@@ -0,0 +1,52 @@
+#pragma once
+
+#include "pool.h"
+#include <mpv/client.h>
+
+typedef struct Player Player;
+
+struct Child;
+
+// Operations every player implementation provides, modeled on the libmpv
+// client API so main.c can drive mpv, a child process or the mock the same way.
+typedef struct {
+  int (*command)(Player *player, const char **args);
+  int (*command_async)(Player *player, const char **args);
+  int (*set_property_string)(Player *player, const char *name, const char *data);
+  // Same contract as mpv_wait_event with a timeout of 0.
+  mpv_event *(*wait_event)(Player *player);
+  void (*destroy)(Player *player);
+} PlayerBackend;
+
+struct Player {
+  const PlayerBackend *backend;
+  const char *name;
+  void *handle;
+};
+
+Player *player_new(const PlayerBackend *backend, const char *name, void *handle);
+
+// Player running in this process. With a pool, screenshot-raw is taken and
+// downsampled on it and replies with a y8 thumbnail like the other players.
+Player *player_mpv_new(const char *name, mpv_handle *mpv, Pool *pool);
+
+// Player running in a supervised child process.
+Player *player_child_new(const char *name, struct Child *child);
+
+int player_command(Player *player, const char **args);
+
+int player_command_async(Player *player, const char **args);
+
+int player_set_property_string(Player *player, const char *name, const char *data);
+
+mpv_event *player_wait_event(Player *player);
+
+void player_destroy(Player *player);
+
+void player_loadfile(Player *player, const char *stream);
+
+void player_stop(Player *player);
+
+void player_seek(Player *player, double target, const char *flags);
+
+void player_set_speed(Player *player, double speed);
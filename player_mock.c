@@ -0,0 +1,226 @@
+#include "player_mock.h"
+#include "util.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MOCK_MAX_STEPS 16
+#define MOCK_MAX_EVENTS 64
+// mpv reports playback properties about as often as frames are shown
+#define MOCK_REPORT_MS 40
+#define MOCK_LOAD_MS 300
+
+typedef struct {
+  int64_t at_ms;
+  MockAction action;
+  double value;
+} MockStep;
+
+typedef struct {
+  mpv_event_id event_id;
+  int error;
+  const char *name;
+  mpv_format format;
+  double double_;
+  int64_t int64;
+} MockEvent;
+
+typedef struct {
+  int width;
+  int height;
+
+  int64_t now_ms;
+  int64_t reported_at_ms;
+  int64_t loaded_at_ms;
+  int loading;
+  int playing;
+  int stalled;
+  int frozen;
+  double delay;
+  double cache_time;
+  double speed;
+  int loads;
+  int calls;
+  const char *file;
+
+  MockStep steps[MOCK_MAX_STEPS];
+  int step_count;
+  int step_next;
+
+  MockEvent events[MOCK_MAX_EVENTS];
+  int event_head;
+  int event_count;
+
+  // Storage for the event returned by wait_event, valid until the next call
+  mpv_event event;
+  mpv_event_property property;
+  mpv_event_command command;
+  double double_;
+  int64_t int64;
+} Mock;
+
+static void push(Mock *mock, MockEvent event) {
+  // Like mpv, events are dropped when nobody reads them
+  if (mock->event_count == MOCK_MAX_EVENTS)
+    return;
+  mock->events[(mock->event_head + mock->event_count) % MOCK_MAX_EVENTS] = event;
+  mock->event_count++;
+}
+
+static void push_double(Mock *mock, const char *name, double value) {
+  push(mock, (MockEvent){.event_id = MPV_EVENT_PROPERTY_CHANGE, .name = name, .format = MPV_FORMAT_DOUBLE, .double_ = value});
+}
+
+static void push_int64(Mock *mock, const char *name, int64_t value) {
+  push(mock, (MockEvent){.event_id = MPV_EVENT_PROPERTY_CHANGE, .name = name, .format = MPV_FORMAT_INT64, .int64 = value});
+}
+
+static int mock_command(Player *player, const char **args) {
+  Mock *mock = player->handle;
+  mock->calls++;
+  if (strcmp(args[0], "loadfile") == 0) {
+    mock->loads++;
+    mock->file = args[1];
+    mock->loading = 1;
+    mock->playing = 0;
+    mock->loaded_at_ms = mock->now_ms + MOCK_LOAD_MS;
+  } else if (strcmp(args[0], "stop") == 0) {
+    mock->file = NULL;
+    mock->loading = 0;
+    mock->playing = 0;
+  } else if (strcmp(args[0], "screenshot-raw") == 0) {
+    push(mock, (MockEvent){.event_id = MPV_EVENT_COMMAND_REPLY, .error = MPV_ERROR_NOT_IMPLEMENTED});
+  }
+  return 0;
+}
+
+static int mock_set_property_string(Player *player, const char *name, const char *data) {
+  Mock *mock = player->handle;
+  mock->calls++;
+  if (strcmp(name, "speed") == 0)
+    mock->speed = atof(data);
+  return 0;
+}
+
+static mpv_event *mock_wait_event(Player *player) {
+  Mock *mock = player->handle;
+  memset(&mock->event, 0, sizeof(mock->event));
+  if (mock->event_count == 0)
+    return &mock->event;
+
+  MockEvent event = mock->events[mock->event_head];
+  mock->event_head = (mock->event_head + 1) % MOCK_MAX_EVENTS;
+  mock->event_count--;
+
+  mock->event.event_id = event.event_id;
+  mock->event.error = event.error;
+  if (event.event_id == MPV_EVENT_PROPERTY_CHANGE) {
+    mock->property = (mpv_event_property){.name = event.name, .format = event.format};
+    mock->double_ = event.double_;
+    mock->int64 = event.int64;
+    mock->property.data = event.format == MPV_FORMAT_DOUBLE ? (void *)&mock->double_ : (void *)&mock->int64;
+    mock->event.data = &mock->property;
+  } else if (event.event_id == MPV_EVENT_COMMAND_REPLY) {
+    memset(&mock->command, 0, sizeof(mock->command));
+    mock->event.data = &mock->command;
+  }
+  return &mock->event;
+}
+
+static void mock_destroy(Player *player) {
+  free(player->handle);
+}
+
+static const PlayerBackend mock_backend = {
+    .command = mock_command,
+    .command_async = mock_command,
+    .set_property_string = mock_set_property_string,
+    .wait_event = mock_wait_event,
+    .destroy = mock_destroy,
+};
+
+Player *player_mock_new(const char *name, int width, int height) {
+  Mock *mock = calloc(1, sizeof(Mock));
+  if (mock == NULL)
+    die("failed to allocate mock player");
+  mock->width = width;
+  mock->height = height;
+  mock->speed = 1.0;
+  mock->delay = 0.2;
+  return player_new(&mock_backend, name, mock);
+}
+
+void player_mock_script(Player *player, int64_t at_ms, MockAction action, double value) {
+  Mock *mock = player->handle;
+  if (mock->step_count == MOCK_MAX_STEPS)
+    die("too many mock steps");
+  mock->steps[mock->step_count++] = (MockStep){.at_ms = at_ms, .action = action, .value = value};
+}
+
+void player_mock_advance(Player *player, int64_t now_ms) {
+  Mock *mock = player->handle;
+  int64_t elapsed_ms = now_ms - mock->now_ms;
+  mock->now_ms = now_ms;
+
+  for (; mock->step_next < mock->step_count && mock->steps[mock->step_next].at_ms <= now_ms; mock->step_next++) {
+    MockStep step = mock->steps[mock->step_next];
+    switch (step.action) {
+    case MOCK_DELAY:
+      mock->delay = step.value;
+      break;
+    case MOCK_STALL:
+      mock->stalled = 1;
+      break;
+    case MOCK_FREEZE:
+      mock->frozen = 1;
+      break;
+    case MOCK_RESUME:
+      mock->stalled = 0;
+      mock->frozen = 0;
+      break;
+    case MOCK_SHUTDOWN:
+      push(mock, (MockEvent){.event_id = MPV_EVENT_SHUTDOWN});
+      break;
+    }
+  }
+
+  if (mock->loading && now_ms >= mock->loaded_at_ms) {
+    mock->loading = 0;
+    mock->playing = 1;
+    mock->cache_time = 0;
+    push(mock, (MockEvent){.event_id = MPV_EVENT_FILE_LOADED});
+    push_int64(mock, "width", mock->width);
+    push_int64(mock, "height", mock->height);
+    push(mock, (MockEvent){.event_id = MPV_EVENT_PLAYBACK_RESTART});
+  }
+
+  if (!mock->playing || mock->stalled)
+    return;
+
+  // Faster playback eats into the buffer, which is what the speed controller relies on
+  mock->cache_time += elapsed_ms / 1000.0;
+  if (mock->speed > 1.0)
+    mock->delay = MAX(mock->delay - (mock->speed - 1.0) * elapsed_ms / 1000.0, 0.05);
+
+  if (now_ms < mock->reported_at_ms + MOCK_REPORT_MS)
+    return;
+  mock->reported_at_ms = now_ms;
+  push_double(mock, "demuxer-cache-time", mock->cache_time);
+  if (!mock->frozen)
+    push_double(mock, "playback-time", mock->cache_time - mock->delay);
+}
+
+int player_mock_loads(Player *player) {
+  return ((Mock *)player->handle)->loads;
+}
+
+double player_mock_speed(Player *player) {
+  return ((Mock *)player->handle)->speed;
+}
+
+int player_mock_calls(Player *player) {
+  return ((Mock *)player->handle)->calls;
+}
+
+const char *player_mock_file(Player *player) {
+  return ((Mock *)player->handle)->file;
+}
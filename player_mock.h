@@ -0,0 +1,38 @@
+#pragma once
+
+#include "player.h"
+#include <stdint.h>
+
+// In-memory player that plays nothing. It reports the properties main.c
+// observes on a simulated clock, so the stream logic can be exercised and
+// benchmarked without video. What it reports is driven by a script.
+
+typedef enum {
+  // Seconds received but not shown yet, playback-time trails demuxer-cache-time by it
+  MOCK_DELAY,
+  // Stop reporting properties, like a stream whose network hangs
+  MOCK_STALL,
+  // Keep receiving but stop showing, only demuxer-cache-time is reported,
+  // like a decoder that hangs while the network is fine
+  MOCK_FREEZE,
+  MOCK_RESUME,
+  MOCK_SHUTDOWN,
+} MockAction;
+
+Player *player_mock_new(const char *name, int width, int height);
+
+// Runs action once the clock reaches at_ms, steps must be added in order.
+void player_mock_script(Player *player, int64_t at_ms, MockAction action, double value);
+
+// Moves the clock forward and queues the events that happened until now_ms.
+void player_mock_advance(Player *player, int64_t now_ms);
+
+int player_mock_loads(Player *player);
+
+double player_mock_speed(Player *player);
+
+// Commands and property writes received, what a real player would have to process.
+int player_mock_calls(Player *player);
+
+// File loaded last, NULL once stopped.
+const char *player_mock_file(Player *player);
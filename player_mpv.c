@@ -0,0 +1,149 @@
+#include "activity.h"
+#include "player.h"
+#include "util.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+typedef struct {
+  mpv_handle *mpv;
+
+  // screenshot-raw returns the whole frame, it is taken and shrunk on the
+  // pool so only the thumbnail reaches the main thread
+  Pool *pool;
+  pthread_mutex_t lock;
+  pthread_cond_t captured;
+  int capturing;
+  int has_reply;
+  int reply_error;
+  uint8_t thumb[ACTIVITY_THUMB_SIZE];
+
+  // Storage for the reply returned by wait_event, valid until the next call
+  mpv_event event;
+  mpv_event_command command;
+  mpv_node reply_values[5];
+  mpv_node_list reply_list;
+  mpv_byte_array reply_data;
+  uint8_t reply_thumb[ACTIVITY_THUMB_SIZE];
+} Mpv;
+
+static char *reply_keys[] = {"w", "h", "stride", "format", "data"};
+
+static void capture_task(void *arg) {
+  Mpv *mpv = arg;
+  const char *cmd[] = {"screenshot-raw", "video", NULL};
+  uint8_t thumb[ACTIVITY_THUMB_SIZE];
+  mpv_node result;
+  int err = mpv_command_ret(mpv->mpv, cmd, &result);
+  if (err >= 0) {
+    if (activity_thumbnail_node(&result, thumb) < 0)
+      err = MPV_ERROR_UNSUPPORTED;
+    mpv_free_node_contents(&result);
+  }
+
+  pthread_mutex_lock(&mpv->lock);
+  if (err >= 0)
+    memcpy(mpv->thumb, thumb, ACTIVITY_THUMB_SIZE);
+  mpv->reply_error = err;
+  mpv->has_reply = 1;
+  mpv->capturing = 0;
+  pthread_cond_broadcast(&mpv->captured);
+  pthread_mutex_unlock(&mpv->lock);
+}
+
+// Returns 1 when the command was a screenshot taken on the pool.
+static int capture(Mpv *mpv, const char **args) {
+  if (!mpv->pool || strcmp(args[0], "screenshot-raw") != 0)
+    return 0;
+
+  // A screenshot still being taken answers this request too
+  pthread_mutex_lock(&mpv->lock);
+  int submit = !mpv->capturing;
+  mpv->capturing = 1;
+  pthread_mutex_unlock(&mpv->lock);
+  if (submit)
+    pool_submit(mpv->pool, capture_task, mpv);
+  return 1;
+}
+
+static int mpv_player_command(Player *player, const char **args) {
+  Mpv *mpv = player->handle;
+  if (capture(mpv, args))
+    return 0;
+  return mpv_command(mpv->mpv, args);
+}
+
+static int mpv_player_command_async(Player *player, const char **args) {
+  Mpv *mpv = player->handle;
+  if (capture(mpv, args))
+    return 0;
+  return mpv_command_async(mpv->mpv, 0, args);
+}
+
+static int mpv_player_set_property_string(Player *player, const char *name, const char *data) {
+  return mpv_set_property_string(((Mpv *)player->handle)->mpv, name, data);
+}
+
+static mpv_event *mpv_player_wait_event(Player *player) {
+  Mpv *mpv = player->handle;
+
+  pthread_mutex_lock(&mpv->lock);
+  if (!mpv->has_reply) {
+    pthread_mutex_unlock(&mpv->lock);
+    return mpv_wait_event(mpv->mpv, 0);
+  }
+  mpv->has_reply = 0;
+  int err = mpv->reply_error;
+  memcpy(mpv->reply_thumb, mpv->thumb, ACTIVITY_THUMB_SIZE);
+  pthread_mutex_unlock(&mpv->lock);
+
+  // Same shape as a screenshot-raw reply forwarded by a child process
+  memset(&mpv->event, 0, sizeof(mpv->event));
+  memset(&mpv->command, 0, sizeof(mpv->command));
+  mpv->event.event_id = MPV_EVENT_COMMAND_REPLY;
+  mpv->event.error = err < 0 ? err : 0;
+  if (err >= 0) {
+    mpv->reply_data = (mpv_byte_array){.data = mpv->reply_thumb, .size = ACTIVITY_THUMB_SIZE};
+    mpv->reply_values[0] = (mpv_node){.format = MPV_FORMAT_INT64, .u.int64 = ACTIVITY_THUMB_WIDTH};
+    mpv->reply_values[1] = (mpv_node){.format = MPV_FORMAT_INT64, .u.int64 = ACTIVITY_THUMB_HEIGHT};
+    mpv->reply_values[2] = (mpv_node){.format = MPV_FORMAT_INT64, .u.int64 = ACTIVITY_THUMB_WIDTH};
+    mpv->reply_values[3] = (mpv_node){.format = MPV_FORMAT_STRING, .u.string = "y8"};
+    mpv->reply_values[4] = (mpv_node){.format = MPV_FORMAT_BYTE_ARRAY, .u.ba = &mpv->reply_data};
+    mpv->reply_list = (mpv_node_list){.num = 5, .keys = reply_keys, .values = mpv->reply_values};
+    mpv->command.result = (mpv_node){.format = MPV_FORMAT_NODE_MAP, .u.list = &mpv->reply_list};
+  }
+  mpv->event.data = &mpv->command;
+  return &mpv->event;
+}
+
+static void mpv_player_destroy(Player *player) {
+  Mpv *mpv = player->handle;
+  pthread_mutex_lock(&mpv->lock);
+  while (mpv->capturing)
+    pthread_cond_wait(&mpv->captured, &mpv->lock);
+  pthread_mutex_unlock(&mpv->lock);
+
+  mpv_destroy(mpv->mpv);
+  pthread_mutex_destroy(&mpv->lock);
+  pthread_cond_destroy(&mpv->captured);
+  free(mpv);
+}
+
+static const PlayerBackend mpv_backend = {
+    .command = mpv_player_command,
+    .command_async = mpv_player_command_async,
+    .set_property_string = mpv_player_set_property_string,
+    .wait_event = mpv_player_wait_event,
+    .destroy = mpv_player_destroy,
+};
+
+Player *player_mpv_new(const char *name, mpv_handle *mpv, Pool *pool) {
+  Mpv *player = calloc(1, sizeof(Mpv));
+  if (player == NULL)
+    die("failed to allocate player");
+  player->mpv = mpv;
+  player->pool = pool;
+  pthread_mutex_init(&player->lock, NULL);
+  pthread_cond_init(&player->captured, NULL);
+  return player_new(&mpv_backend, name, player);
+}
@@ -0,0 +1,206 @@
+#include "pool.h"
+#include "trace.h"
+#include "util.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+#define POOL_QUEUE_SIZE 1024
+
+typedef struct {
+  PoolTask task;
+  void *arg;
+} PoolItem;
+
+// Owner pushes and pops at the bottom, thieves take from the top.
+typedef struct {
+  pthread_mutex_t lock;
+  PoolItem items[POOL_QUEUE_SIZE];
+  unsigned top;
+  unsigned bottom;
+} PoolQueue;
+
+struct Pool {
+  int thread_count;
+  pthread_t threads[POOL_MAX_THREADS];
+  PoolQueue queues[POOL_MAX_THREADS];
+
+  pthread_mutex_t lock;
+  pthread_cond_t wake;
+  pthread_cond_t idle;
+  int pending;
+  int running;
+  int stopping;
+  unsigned next;
+  long steals;
+};
+
+typedef struct {
+  Pool *pool;
+  int index;
+} PoolWorker;
+
+static __thread PoolWorker *current_worker;
+
+static int queue_push(PoolQueue *queue, PoolItem item) {
+  pthread_mutex_lock(&queue->lock);
+  int ok = queue->bottom - queue->top < POOL_QUEUE_SIZE;
+  if (ok)
+    queue->items[queue->bottom++ % POOL_QUEUE_SIZE] = item;
+  pthread_mutex_unlock(&queue->lock);
+  return ok;
+}
+
+static int queue_pop(PoolQueue *queue, PoolItem *item) {
+  pthread_mutex_lock(&queue->lock);
+  int ok = queue->bottom != queue->top;
+  if (ok)
+    *item = queue->items[--queue->bottom % POOL_QUEUE_SIZE];
+  pthread_mutex_unlock(&queue->lock);
+  return ok;
+}
+
+static int queue_steal(PoolQueue *queue, PoolItem *item) {
+  pthread_mutex_lock(&queue->lock);
+  int ok = queue->bottom != queue->top;
+  if (ok)
+    *item = queue->items[queue->top++ % POOL_QUEUE_SIZE];
+  pthread_mutex_unlock(&queue->lock);
+  return ok;
+}
+
+static int find_task(Pool *pool, int index, PoolItem *item) {
+  if (queue_pop(&pool->queues[index], item))
+    return 1;
+  for (int i = 1; i < pool->thread_count; i++)
+    if (queue_steal(&pool->queues[(index + i) % pool->thread_count], item)) {
+      __atomic_add_fetch(&pool->steals, 1, __ATOMIC_RELAXED);
+      return 1;
+    }
+  return 0;
+}
+
+static void *worker_main(void *arg) {
+  PoolWorker *worker = arg;
+  Pool *pool = worker->pool;
+  current_worker = worker;
+  TRACE_THREAD("pool worker");
+
+  while (1) {
+    PoolItem item;
+    if (find_task(pool, worker->index, &item)) {
+      pthread_mutex_lock(&pool->lock);
+      pool->pending--;
+      pool->running++;
+      pthread_mutex_unlock(&pool->lock);
+
+      TRACE_BEGIN("task", NULL);
+      item.task(item.arg);
+      TRACE_END();
+
+      pthread_mutex_lock(&pool->lock);
+      pool->running--;
+      if (pool->pending == 0 && pool->running == 0)
+        pthread_cond_broadcast(&pool->idle);
+      pthread_mutex_unlock(&pool->lock);
+      continue;
+    }
+
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending == 0 && !pool->stopping)
+      pthread_cond_wait(&pool->wake, &pool->lock);
+    int stopping = pool->stopping && pool->pending == 0;
+    pthread_mutex_unlock(&pool->lock);
+    if (stopping)
+      break;
+  }
+
+  free(worker);
+  return NULL;
+}
+
+Pool *pool_new(int threads) {
+  if (threads <= 0)
+    threads = sysconf(_SC_NPROCESSORS_ONLN);
+  threads = MIN(MAX(threads, 1), POOL_MAX_THREADS);
+
+  Pool *pool = calloc(1, sizeof(Pool));
+  if (pool == NULL)
+    die("failed to allocate pool");
+  pool->thread_count = threads;
+  pthread_mutex_init(&pool->lock, NULL);
+  pthread_cond_init(&pool->wake, NULL);
+  pthread_cond_init(&pool->idle, NULL);
+
+  for (int i = 0; i < threads; i++)
+    pthread_mutex_init(&pool->queues[i].lock, NULL);
+  for (int i = 0; i < threads; i++) {
+    PoolWorker *worker = malloc(sizeof(PoolWorker));
+    worker->pool = pool;
+    worker->index = i;
+    if (pthread_create(&pool->threads[i], NULL, worker_main, worker) != 0)
+      die("failed to create pool thread");
+  }
+  return pool;
+}
+
+void pool_submit(Pool *pool, PoolTask task, void *arg) {
+  PoolItem item = {.task = task, .arg = arg};
+  int start = current_worker && current_worker->pool == pool
+                  ? current_worker->index
+                  : __atomic_fetch_add(&pool->next, 1, __ATOMIC_RELAXED) % pool->thread_count;
+
+  // Counted before it is queued so a worker can never take it first
+  pthread_mutex_lock(&pool->lock);
+  pool->pending++;
+  pthread_mutex_unlock(&pool->lock);
+
+  int queued = 0;
+  for (int i = 0; i < pool->thread_count && !queued; i++)
+    queued = queue_push(&pool->queues[(start + i) % pool->thread_count], item);
+
+  pthread_mutex_lock(&pool->lock);
+  if (queued) {
+    pthread_cond_signal(&pool->wake);
+  } else {
+    pool->pending--;
+    pool->running++;
+  }
+  pthread_mutex_unlock(&pool->lock);
+  if (queued)
+    return;
+
+  // Every queue is full, run it here rather than drop it
+  task(arg);
+  pthread_mutex_lock(&pool->lock);
+  pool->running--;
+  if (pool->pending == 0 && pool->running == 0)
+    pthread_cond_broadcast(&pool->idle);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+void pool_wait(Pool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  while (pool->pending > 0 || pool->running > 0)
+    pthread_cond_wait(&pool->idle, &pool->lock);
+  pthread_mutex_unlock(&pool->lock);
+}
+
+int pool_thread_count(Pool *pool) {
+  return pool->thread_count;
+}
+
+long pool_steals(Pool *pool) {
+  return __atomic_load_n(&pool->steals, __ATOMIC_RELAXED);
+}
+
+void pool_free(Pool *pool) {
+  pthread_mutex_lock(&pool->lock);
+  pool->stopping = 1;
+  pthread_cond_broadcast(&pool->wake);
+  pthread_mutex_unlock(&pool->lock);
+
+  for (int i = 0; i < pool->thread_count; i++)
+    pthread_join(pool->threads[i], NULL);
+  free(pool);
+}
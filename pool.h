@@ -0,0 +1,27 @@
+#pragma once
+
+// Fixed set of worker threads shared by all thumbnail streams. Each worker
+// has its own queue and steals from the others when it runs dry, so a busy
+// stream does not hold up the rest.
+
+#define POOL_MAX_THREADS 64
+
+typedef void (*PoolTask)(void *arg);
+
+typedef struct Pool Pool;
+
+// Zero or less picks one thread per online CPU.
+Pool *pool_new(int threads);
+
+// Tasks submitted from a worker go to its own queue, others are spread round robin.
+void pool_submit(Pool *pool, PoolTask task, void *arg);
+
+// Blocks until every submitted task has run.
+void pool_wait(Pool *pool);
+
+int pool_thread_count(Pool *pool);
+
+// Number of tasks a worker took from another worker's queue.
+long pool_steals(Pool *pool);
+
+void pool_free(Pool *pool);
@@ -0,0 +1,165 @@
+#define _GNU_SOURCE
+#include "stream.h"
+#include "trace.h"
+#include "util.h"
+#include <stdio.h>
+#include <string.h>
+
+const char *MPV_PROPERTY_DEMUXER_CACHE_TIME = "demuxer-cache-time";
+const char *MPV_PROPERTY_PLAYBACK_TIME = "playback-time";
+const char *MPV_PROPERTY_DEMUXER_CACHE_STATE = "demuxer-cache-state";
+const char *MPV_PROPERTY_FPS = "estimated-vf-fps";
+const char *MPV_PROPERTY_BITRATE = "video-bitrate";
+const char *MPV_PROPERTY_FRAME_DROPS = "frame-drop-count";
+const char *MPV_PROPERTY_DECODER_DROPS = "decoder-frame-drop-count";
+const char *MPV_PROPERTY_WIDTH = "width";
+const char *MPV_PROPERTY_HEIGHT = "height";
+const double MPV_MAX_DELAY_SEC = 0.5;
+const double MPV_MIN_DISPLAY_SEC = 0.1;
+const int MPV_TIMEOUT_SEC = 5;
+
+StreamChange stream_update_speed(StreamState *stream, double speed, int now) {
+  if (stream->speed == speed)
+    return 0;
+  fprintf(stderr, "%s: updating speed: %f -> %f\n", stream->name, stream->speed, speed);
+  stream->speed = speed;
+  stream->speed_updated_at = now;
+  return STREAM_CHANGED_SPEED;
+}
+
+StreamChange stream_reload(StreamState *stream, int now) {
+  fprintf(stderr, "%s: reloading stream\n", stream->name);
+  TRACE_INSTANT("reload", stream->name);
+  stream->reloads++;
+  stream->pinged_at = now;
+  return STREAM_CHANGED_RELOAD;
+}
+
+static void update_activity(StreamState *stream, mpv_event *event) {
+  uint8_t thumb[ACTIVITY_THUMB_SIZE];
+  if (event->error < 0 || activity_thumbnail_node(&((mpv_event_command *)event->data)->result, thumb) < 0)
+    return;
+  if (stream->has_thumb)
+    stream->activity = activity_energy(stream->activity, activity_diff(stream->thumb, thumb, ACTIVITY_THUMB_SIZE));
+  memcpy(stream->thumb, thumb, ACTIVITY_THUMB_SIZE);
+  stream->has_thumb = 1;
+}
+
+static StreamChange update_source(StreamState *stream, const char *name, int64_t value) {
+  int *size = strcmp(name, MPV_PROPERTY_WIDTH) == 0 ? &stream->source.width : &stream->source.height;
+  if (*size == value)
+    return 0;
+  *size = value;
+  return STREAM_CHANGED_SOURCE;
+}
+
+static StreamChange handle_property(StreamState *stream, mpv_event_property *property, int now) {
+  StreamChange change = 0;
+
+  if (strcmp(property->name, MPV_PROPERTY_DEMUXER_CACHE_STATE) == 0) {
+    mpv_node *node = property->data;
+    if (node && node->format == MPV_FORMAT_NODE_MAP)
+      for (int i = 0; i < node->u.list->num; i++)
+        if (strcmp(node->u.list->keys[i], "total-bytes") == 0)
+          stream->cache_bytes = node->u.list->values[i].u.int64;
+    return 0;
+  }
+
+  if (strcmp(property->name, MPV_PROPERTY_FPS) == 0 || strcmp(property->name, MPV_PROPERTY_BITRATE) == 0) {
+    double value = property->data ? *(double *)property->data : 0;
+    if (strcmp(property->name, MPV_PROPERTY_FPS) == 0)
+      stream->fps = value;
+    else
+      stream->bitrate = value;
+    return 0;
+  }
+  if (strcmp(property->name, MPV_PROPERTY_FRAME_DROPS) == 0 || strcmp(property->name, MPV_PROPERTY_DECODER_DROPS) == 0) {
+    int64_t value = property->data ? *(int64_t *)property->data : 0;
+    if (strcmp(property->name, MPV_PROPERTY_FRAME_DROPS) == 0)
+      stream->frame_drops = value;
+    else
+      stream->decoder_drops = value;
+    return 0;
+  }
+
+  if (strcmp(property->name, MPV_PROPERTY_WIDTH) == 0 || strcmp(property->name, MPV_PROPERTY_HEIGHT) == 0) {
+    // Keep the last known size while the stream is stopped or reconnecting
+    if (property->data)
+      return update_source(stream, property->name, *(int64_t *)property->data);
+    return 0;
+  }
+
+  // time-remaining counts down to the end of the file, which a live stream
+  // never reaches, so latency is taken from what was received and shown.
+  // demuxer-cache-time keeps arriving while a hung decoder shows nothing,
+  // only playback-time moving proves the stream plays and pings the watchdog.
+  if (strcmp(property->name, MPV_PROPERTY_DEMUXER_CACHE_TIME) == 0) {
+    if (property->data)
+      stream->cache_time = *(double *)property->data;
+  } else if (strcmp(property->name, MPV_PROPERTY_PLAYBACK_TIME) == 0) {
+    double *data = property->data;
+    if (data) {
+      stream->pinged_at = now;
+      // Latency is how much has been received but not shown yet
+      stream->delay = MAX(stream->cache_time - *data, 0);
+      // fprintf(stderr, "%s: latency: %f\n", stream->name, stream->delay);
+
+      if (stream->replay != REPLAY_NONE) {
+        // Replay is behind live on purpose
+      } else if (stream->delay > MPV_MAX_DELAY_SEC) {
+        change |= stream_update_speed(stream, 1.5, now);
+      } else if (stream->delay < MPV_MIN_DISPLAY_SEC) {
+        change |= stream_update_speed(stream, 1.0, now);
+      }
+    }
+  }
+  return change;
+}
+
+StreamChange stream_step(StreamState *stream, int playing, int now) {
+  StreamChange change = 0;
+
+  // Reload locked up stream
+  if (playing && now > stream->pinged_at + MPV_TIMEOUT_SEC) {
+    TRACE_INSTANT("stall", stream->name);
+    change |= stream_reload(stream, now);
+  }
+
+  // Reset speed if stuck
+  if (now > stream->speed_updated_at + MPV_TIMEOUT_SEC)
+    change |= stream_update_speed(stream, 1.0, now);
+
+  while (1) {
+    mpv_event *event = player_wait_event(stream->player);
+    if (event->event_id == MPV_EVENT_NONE)
+      break;
+    if (event->event_id == MPV_EVENT_SHUTDOWN)
+      return change | STREAM_CHANGED_SHUTDOWN;
+    if (event->event_id == MPV_EVENT_LOG_MESSAGE) {
+      mpv_event_log_message *msg = event->data;
+      fprintf(stderr, "%s: %s", stream->name, msg->text);
+      continue;
+    }
+    if (event->event_id == MPV_EVENT_FILE_LOADED) {
+      TRACE_INSTANT("file loaded", stream->name);
+      // The timestamps of the previous file mean nothing for the new one
+      stream->cache_time = 0;
+      continue;
+    }
+    if (event->event_id == MPV_EVENT_PLAYBACK_RESTART) {
+      TRACE_INSTANT("first frame", stream->name);
+      continue;
+    }
+    if (event->event_id == MPV_EVENT_COMMAND_REPLY) {
+      update_activity(stream, event);
+      continue;
+    }
+    if (event->event_id == MPV_EVENT_PROPERTY_CHANGE) {
+      change |= handle_property(stream, event->data, now);
+      continue;
+    }
+    // fprintf(stderr, "%s: unhandled mpv event: %s\n", stream->name, mpv_event_name(event->event_id));
+  }
+
+  return change;
+}
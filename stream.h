@@ -0,0 +1,88 @@
+#pragma once
+
+#include "activity.h"
+#include "child.h"
+#include "config.h"
+#include "cpu.h"
+#include "layout.h"
+#include "memory.h"
+#include "player.h"
+#include <mpv/client.h>
+#include <stdint.h>
+
+// Per-stream logic that does not touch the X server, so it can be driven by
+// any player backend, including the mock on a simulated clock. Times are in
+// seconds from whatever clock the caller uses.
+
+typedef enum {
+  STREAM_CHANGED_SPEED = 0x1,
+  STREAM_CHANGED_RELOAD = 0x2,
+  STREAM_CHANGED_SOURCE = 0x4,
+  STREAM_CHANGED_SHUTDOWN = 0x8,
+} StreamChange;
+
+typedef enum {
+  REPLAY_NONE,
+  REPLAY_STARTING,
+  REPLAY_PLAYING,
+  REPLAY_ENDING,
+} Replay;
+
+typedef struct {
+  uint32_t window;
+  // Player currently used, one of the two below
+  Player *player;
+  Player *full_player;
+  Player *thumb_player;
+  Child *child;
+  char *name;
+  char *main;
+  char *sub;
+  double speed;
+  int speed_updated_at;
+  int pinged_at;
+  double delay;
+  double cache_time;
+  int replay_quota;
+  Replay replay;
+  int replay_until;
+  MemoryRole memory_role;
+  MemoryLimits memory_limits;
+  int64_t cache_bytes;
+  cpu_set_t cpus;
+  int decoder_threads;
+  uint8_t thumb[ACTIVITY_THUMB_SIZE];
+  int has_thumb;
+  double activity;
+  const char *rendition;
+  int overlay_shown;
+  int reloads;
+  double fps;
+  double bitrate;
+  int64_t frame_drops;
+  int64_t decoder_drops;
+  LayoutSource source;
+  ConfigMpvFlags main_mpv_flags;
+  ConfigMpvFlags sub_mpv_flags;
+} StreamState;
+
+extern const double MPV_MAX_DELAY_SEC;
+extern const double MPV_MIN_DISPLAY_SEC;
+extern const int MPV_TIMEOUT_SEC;
+
+extern const char *MPV_PROPERTY_DEMUXER_CACHE_TIME;
+extern const char *MPV_PROPERTY_PLAYBACK_TIME;
+extern const char *MPV_PROPERTY_DEMUXER_CACHE_STATE;
+extern const char *MPV_PROPERTY_FPS;
+extern const char *MPV_PROPERTY_BITRATE;
+extern const char *MPV_PROPERTY_FRAME_DROPS;
+extern const char *MPV_PROPERTY_DECODER_DROPS;
+extern const char *MPV_PROPERTY_WIDTH;
+extern const char *MPV_PROPERTY_HEIGHT;
+
+StreamChange stream_update_speed(StreamState *stream, double speed, int now);
+
+StreamChange stream_reload(StreamState *stream, int now);
+
+// Runs the watchdogs, then handles every pending player event.
+StreamChange stream_step(StreamState *stream, int playing, int now);
@@ -0,0 +1,437 @@
+#define _GNU_SOURCE
+#include "player_mock.h"
+#include "util.h"
+#include "view.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <xcb/xcb.h>
+#ifdef THUMBS
+#include "thumb.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#endif
+
+// Runs the view on mock players against a real X server, Xvfb when started
+// with make test. Every view transition is checked for the X requests and
+// player calls it makes and for the window tree it leaves behind.
+//
+// With THUMBS=1 the thumbnail player also decodes THUMB_CLIP, a 10 second
+// MPEG-TS clip at 25 fps, on the real libav backend.
+//
+// Results are written to stdout as JSON lines like the bench, failed checks
+// to stderr and the exit status.
+
+static int failures = 0;
+// stderr is taken by the player logs, failures go here
+static FILE *errors;
+static xcb_connection_t *connection;
+static xcb_screen_t *screen;
+
+static void check(int ok, const char *name, int streams, const char *msg) {
+  if (ok)
+    return;
+  fprintf(errors, "%s(%d): %s\n", name, streams, msg);
+  failures++;
+}
+
+// Sequence number of a request sent now, the requests in between two calls
+// are the difference minus one.
+static unsigned int x11_sequence() {
+  return xcb_no_operation(connection).sequence;
+}
+
+static void check_x11_errors(const char *name, int streams) {
+  free(xcb_get_input_focus_reply(connection, xcb_get_input_focus(connection), NULL));
+  xcb_generic_event_t *event;
+  while ((event = xcb_poll_for_event(connection))) {
+    if (event->response_type == 0) {
+      xcb_generic_error_t *error = (xcb_generic_error_t *)event;
+      fprintf(errors, "%s(%d): X error %d on request %d\n", name, streams, error->error_code, error->major_code);
+      failures++;
+    }
+    free(event);
+  }
+}
+
+// Every pane must be where stream_pane says, hidden streams unmapped.
+static void check_windows(const char *name) {
+  for (int i = 0; i < state->stream_count; i++) {
+    LayoutWindow pane = stream_pane(i);
+    xcb_get_window_attributes_reply_t *attributes =
+        xcb_get_window_attributes_reply(connection, xcb_get_window_attributes(connection, state->streams[i].window), NULL);
+    xcb_get_geometry_reply_t *geometry =
+        xcb_get_geometry_reply(connection, xcb_get_geometry(connection, state->streams[i].window), NULL);
+    if (attributes == NULL || geometry == NULL)
+      die("failed to query window");
+
+    int mapped = attributes->map_state != XCB_MAP_STATE_UNMAPPED;
+    check(mapped == (pane.width > 0), name, state->stream_count, mapped ? "hidden stream is mapped" : "shown stream is unmapped");
+    if (mapped && pane.width > 0) {
+      int border_width = state->view == VIEW_FULLSCREEN ? 0 : BORDER_WIDTH;
+      check(geometry->x == pane.x && geometry->y == pane.y && geometry->border_width == border_width &&
+                geometry->width == MAX(pane.width - border_width * 2, 1) && geometry->height == MAX(pane.height - border_width * 2, 1),
+            name, state->stream_count, "window does not match its pane");
+    }
+    free(attributes);
+    free(geometry);
+  }
+}
+
+static int player_calls() {
+  int calls = 0;
+  for (int i = 0; i < state->stream_count; i++)
+    if (state->streams[i].full_player)
+      calls += player_mock_calls(state->streams[i].full_player);
+  return calls;
+}
+
+static Player *create_player(int stream_i) {
+  return player_mock_new(state->streams[stream_i].name, 640, 360);
+}
+
+// Runs frames of the main loop on a simulated clock, the players load and
+// report their video size in the meantime.
+static void run_frames(int64_t duration_ms) {
+  const int64_t tick_ms = 1000 / 60;
+  for (int64_t until_ms = state->now_ms + duration_ms; state->now_ms + tick_ms <= until_ms;) {
+    state->now_ms += tick_ms;
+    for (int i = 0; i < state->stream_count; i++)
+      if (state->streams[i].full_player)
+        player_mock_advance(state->streams[i].full_player, state->now_ms);
+    view_update(0);
+  }
+}
+
+static void report(const char *name, int requests, int calls) {
+  printf("{\"name\":\"view\",\"transition\":\"%s\",\"streams\":%d,\"x11_requests\":%d,\"player_calls\":%d}\n",
+         name, state->stream_count, requests, calls);
+}
+
+static void transition(const char *name, Command command, int expected_requests, int expected_calls) {
+  int calls = player_calls();
+  unsigned int sequence = x11_sequence();
+  view_update(command);
+  int requests = x11_sequence() - sequence - 1;
+  calls = player_calls() - calls;
+  report(name, requests, calls);
+
+  check(requests == expected_requests, name, state->stream_count, "unexpected number of X requests");
+  check(calls == expected_calls, name, state->stream_count, "unexpected number of player calls");
+  run_frames(1000);
+  check_x11_errors(name, state->stream_count);
+  check_windows(name);
+}
+
+static void test_view(int count) {
+  state = calloc(1, sizeof(State));
+  state->connection = connection;
+  state->width = screen->width_in_pixels;
+  state->height = screen->height_in_pixels;
+  state->replay_seconds = 30;
+  state->create_player = create_player;
+  for (int i = 0; i < MAX_STREAMS; i++)
+    state->layout_order[i] = i;
+
+  state->window = xcb_generate_id(connection);
+  xcb_create_window(connection, XCB_COPY_FROM_PARENT, state->window, screen->root, 0, 0, state->width, state->height, 0,
+                    XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual, 0, NULL);
+  xcb_map_window(connection, state->window);
+
+  char (*names)[16] = malloc(count * sizeof(*names));
+  uint32_t window_values[] = {BORDER_COLOR};
+  state->stream_count = count;
+  for (int i = 0; i < count; i++) {
+    snprintf(names[i], sizeof(names[i]), "TEST-%04d", i);
+    state->streams[i].name = names[i];
+    state->streams[i].main = "mock://main";
+    state->streams[i].sub = "mock://sub";
+    state->streams[i].speed = 1.0;
+    state->streams[i].window = xcb_generate_id(connection);
+    xcb_create_window(connection, XCB_COPY_FROM_PARENT, state->streams[i].window, state->window, 0, 0, 1, 1, BORDER_WIDTH,
+                      XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual, XCB_CW_BORDER_PIXEL, window_values);
+  }
+  check_x11_errors("setup", count);
+
+  // A pane is configured and mapped per stream, a player call loads each file
+  unsigned int sequence = x11_sequence();
+  view_start();
+  int requests = x11_sequence() - sequence - 1;
+  report("start", requests, player_calls());
+  check(requests == 2 * count, "start", count, "unexpected number of X requests");
+  check(player_calls() == count, "start", count, "unexpected number of player calls");
+
+  // Width and height of every stream arrive as separate events, the panes move once at most
+  sequence = x11_sequence();
+  run_frames(1000);
+  requests = x11_sequence() - sequence - 1;
+  report("sources", requests, 0);
+  check(requests <= 2 * count, "sources", count, "video sizes moved the panes more than once");
+  check_x11_errors("start", count);
+  check_windows("start");
+
+  // Switching to fullscreen unmaps the other panes and stops their players
+  int target = count / 2;
+  transition("hover", activate_window(state->streams[target].window), 0, 0);
+  transition("fullscreen", toggle_fullscreen(state->streams[target].window), count + 1, count);
+  transition("next", go_next(), count + 1, count);
+  transition("previous", go_previous(), count + 1, count);
+  transition("grid", toggle_fullscreen(0), 2 * count, count);
+  transition("resize", update_size(state->width / 2, state->height / 2), 2 * count, 0);
+  transition("overlay", toggle_overlay(), 0, count);
+  transition("overlay_off", toggle_overlay(), 0, count);
+
+  // Nothing changes while every stream plays steadily
+  int calls = player_calls();
+  sequence = x11_sequence();
+  run_frames(60 * 1000);
+  requests = x11_sequence() - sequence - 1;
+  calls = player_calls() - calls;
+  report("steady", requests, calls);
+  check(requests == 0, "steady", count, "X requests while nothing changed");
+  check(calls == 0, "steady", count, "player calls while nothing changed");
+
+  for (int i = 0; i < count; i++) {
+    check(state->streams[i].reloads == 0, "steady", count, "stream was reloaded");
+    player_destroy(state->streams[i].full_player);
+  }
+  xcb_destroy_window(connection, state->window);
+  check_x11_errors("teardown", count);
+  free(names);
+  free(state);
+  state = NULL;
+}
+
+#ifdef THUMBS
+#define THUMB_STREAMS 16
+#define THUMB_SECONDS 10
+// THUMB_CLIP as made by make test
+#define THUMB_CLIP_SECONDS 10
+#define THUMB_FPS 25
+#define THUMB_WIDTH 320
+#define THUMB_HEIGHT 180
+
+// Camera streams arrive in real time, a file would be demuxed as fast as
+// it can be read. The clip is fed through a fifo per stream at its own
+// bitrate instead, looped like a camera that never ends.
+typedef struct {
+  const char *clip;
+  int fds[THUMB_STREAMS];
+  int count;
+  int stopping;
+} Feeder;
+
+static int64_t clock_ms() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static void *feed_main(void *arg) {
+  Feeder *feeder = arg;
+  FILE *file = fopen(feeder->clip, "rb");
+  if (file == NULL)
+    die("failed to open THUMB_CLIP");
+  fseek(file, 0, SEEK_END);
+  long size = ftell(file);
+  // Whole 188 byte TS packets every 20 ms, at the rate the clip plays
+  long chunk = size / (THUMB_CLIP_SECONDS * 50) / 188 * 188 + 188;
+  char *buffer = malloc(chunk);
+
+  rewind(file);
+  for (int64_t next_ms = clock_ms(); !__atomic_load_n(&feeder->stopping, __ATOMIC_ACQUIRE); next_ms += 20) {
+    size_t read = fread(buffer, 1, chunk, file);
+    if (read < chunk)
+      rewind(file);
+    // Nobody reads a stopped stream, what does not fit is lost like on the network
+    for (int i = 0; i < feeder->count; i++)
+      if (write(feeder->fds[i], buffer, read) < 0 && errno != EAGAIN)
+        die("failed to feed stream");
+    int64_t wait_ms = next_ms - clock_ms();
+    if (wait_ms > 0)
+      usleep(wait_ms * 1000);
+  }
+
+  free(buffer);
+  fclose(file);
+  return NULL;
+}
+
+static int64_t cpu_ms() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return (int64_t)(usage.ru_utime.tv_sec + usage.ru_stime.tv_sec) * 1000 + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) / 1000;
+}
+
+// Reads the events a thumbnail player queued, the only log messages it
+// sends are errors.
+static void drain_thumb(Player *player, const char *name, int *reported) {
+  mpv_event *event;
+  while ((event = player_wait_event(player))->event_id != MPV_EVENT_NONE) {
+    if (event->event_id == MPV_EVENT_LOG_MESSAGE) {
+      fprintf(errors, "%s: %s", name, ((mpv_event_log_message *)event->data)->text);
+      failures++;
+    }
+    if (event->event_id == MPV_EVENT_PROPERTY_CHANGE && strcmp(((mpv_event_property *)event->data)->name, "playback-time") == 0)
+      *reported = 1;
+  }
+}
+
+// Hands the MIT-SHM completions to the players like the main loop does,
+// a player that never gets one only shows a frame per second.
+static int complete_thumbs(Player **players, int count, uint8_t completion) {
+  int completed = 0;
+  xcb_generic_event_t *event;
+  while ((event = xcb_poll_for_event(connection))) {
+    if (event->response_type == 0) {
+      fprintf(errors, "thumbs(%d): X error %d on request %d\n", count, ((xcb_generic_error_t *)event)->error_code,
+              ((xcb_generic_error_t *)event)->major_code);
+      failures++;
+    } else if ((event->response_type & ~0x80) == completion) {
+      for (int i = 0; i < count; i++)
+        player_thumb_completed(players[i], (xcb_shm_completion_event_t *)event);
+      completed++;
+    }
+    free(event);
+  }
+  return completed;
+}
+
+// Decodes the clip on every pane for a few seconds, then restarts and
+// destroys the players while their frames are still being decoded.
+static void test_thumbs(const char *clip, int count) {
+  Pool *pool = pool_new(0);
+  uint8_t completion = player_thumb_completion_type(connection);
+  check(completion != 0, "thumbs", count, "server has no MIT-SHM extension");
+  xcb_window_t parent = xcb_generate_id(connection);
+  xcb_create_window(connection, XCB_COPY_FROM_PARENT, parent, screen->root, 0, 0, screen->width_in_pixels,
+                    screen->height_in_pixels, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual, 0, NULL);
+  xcb_map_window(connection, parent);
+
+  Feeder feeder = {.clip = clip, .count = count};
+  char paths[THUMB_STREAMS][64];
+  char names[THUMB_STREAMS][16];
+  Player *players[THUMB_STREAMS];
+  int reported[THUMB_STREAMS] = {0};
+  for (int i = 0; i < count; i++) {
+    snprintf(paths[i], sizeof(paths[i]), "/tmp/camviewport-test-%d-%d.ts", getpid(), i);
+    snprintf(names[i], sizeof(names[i]), "THUMB-%02d", i);
+    // Opened read-write so neither side blocks waiting for the other
+    if (mkfifo(paths[i], 0600) < 0 || (feeder.fds[i] = open(paths[i], O_RDWR | O_NONBLOCK)) < 0)
+      die("failed to create fifo");
+    fcntl(feeder.fds[i], F_SETPIPE_SZ, 1024 * 1024);
+
+    xcb_window_t window = xcb_generate_id(connection);
+    xcb_create_window(connection, XCB_COPY_FROM_PARENT, window, parent, (i % 4) * THUMB_WIDTH, (i / 4) * THUMB_HEIGHT,
+                      THUMB_WIDTH, THUMB_HEIGHT, 0, XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual, 0, NULL);
+    xcb_map_window(connection, window);
+    players[i] = player_thumb_new(names[i], connection, window, screen->root_depth, pool);
+    player_thumb_resize(players[i], THUMB_WIDTH, THUMB_HEIGHT);
+  }
+  xcb_flush(connection);
+
+  pthread_t feed_thread;
+  if (pthread_create(&feed_thread, NULL, feed_main, &feeder) != 0)
+    die("failed to start feeder");
+
+  for (int i = 0; i < count; i++)
+    player_command(players[i], (const char *[]){"loadfile", paths[i], NULL});
+
+  // Opening the streams probes the first packets, measure once they decode
+  for (int64_t until_ms = clock_ms() + 2000; clock_ms() < until_ms; usleep(10000)) {
+    complete_thumbs(players, count, completion);
+    for (int i = 0; i < count; i++)
+      drain_thumb(players[i], names[i], &reported[i]);
+  }
+
+  int64_t frames = 0;
+  for (int i = 0; i < count; i++)
+    frames -= player_thumb_frames(players[i]);
+  int64_t started_ms = clock_ms();
+  int64_t started_cpu_ms = cpu_ms();
+  int64_t completed = 0;
+  for (int64_t until_ms = started_ms + THUMB_SECONDS * 1000; clock_ms() < until_ms; usleep(10000)) {
+    completed += complete_thumbs(players, count, completion);
+    for (int i = 0; i < count; i++)
+      drain_thumb(players[i], names[i], &reported[i]);
+  }
+  double seconds = (clock_ms() - started_ms) / 1000.0;
+  double cpu_seconds = (cpu_ms() - started_cpu_ms) / 1000.0;
+  for (int i = 0; i < count; i++) {
+    frames += player_thumb_frames(players[i]);
+    check(reported[i], "thumbs", count, "stream never reported its playback time");
+  }
+
+  double decoded = frames / (seconds * THUMB_FPS * count);
+  printf("{\"name\":\"thumbs\",\"streams\":%d,\"threads\":%d,\"fps\":%.1f,\"decoded\":%.3f,\"cpu_ms_per_stream_sec\":%.2f,"
+         "\"steals\":%ld}\n",
+         count, pool_thread_count(pool), frames / seconds, decoded, cpu_seconds * 1000 / (seconds * count), pool_steals(pool));
+  // Frames are only dropped when decoding falls behind, a few during
+  // keyframe catch up are expected
+  check(decoded > 0.9, "thumbs", count, "frames were dropped");
+  // Each pane gets a fresh image at least every few frames
+  check(completed > seconds * count * THUMB_FPS / 4, "thumbs", count, "panes stopped presenting");
+
+  // Stopping and destroying has to wait for decodes already on the pool
+  for (int round = 0; round < 10; round++) {
+    for (int i = 0; i < count; i++) {
+      player_command(players[i], (const char *[]){"stop", NULL});
+      player_command(players[i], (const char *[]){"loadfile", paths[i], NULL});
+    }
+    usleep(200000);
+  }
+  for (int i = 0; i < count; i++) {
+    drain_thumb(players[i], names[i], &reported[i]);
+    player_destroy(players[i]);
+  }
+
+  __atomic_store_n(&feeder.stopping, 1, __ATOMIC_RELEASE);
+  pthread_join(feed_thread, NULL);
+  for (int i = 0; i < count; i++) {
+    close(feeder.fds[i]);
+    unlink(paths[i]);
+  }
+  pool_free(pool);
+  xcb_destroy_window(connection, parent);
+  check_x11_errors("thumbs", count);
+}
+#endif
+
+int main() {
+  int screen_number;
+  connection = xcb_connect(NULL, &screen_number);
+  if (xcb_connection_has_error(connection))
+    die("failed to open display, run through xvfb-run");
+
+  xcb_screen_iterator_t screens = xcb_setup_roots_iterator(xcb_get_setup(connection));
+  for (int i = 0; i < screen_number; i++)
+    xcb_screen_next(&screens);
+  screen = screens.data;
+
+  // View switches and speed changes are logged, keep them out of the results
+  errors = fdopen(dup(STDERR_FILENO), "w");
+  if (errors == NULL || freopen("/dev/null", "w", stderr) == NULL)
+    die("failed to redirect stderr");
+
+  int streams[] = {1, 16, MAX_STREAMS};
+  for (int i = 0; i < sizeof(streams) / sizeof(streams[0]); i++)
+    test_view(streams[i]);
+#ifdef THUMBS
+  const char *clip = getenv("THUMB_CLIP");
+  if (clip == NULL)
+    die("THUMB_CLIP is not set");
+  test_thumbs(clip, THUMB_STREAMS);
+#endif
+
+  xcb_disconnect(connection);
+  if (failures) {
+    fprintf(errors, "%d checks failed\n", failures);
+    return 1;
+  }
+  return 0;
+}
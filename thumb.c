@@ -0,0 +1,582 @@
+#ifdef THUMBS
+
+#include "thumb.h"
+#include "activity.h"
+#include "util.h"
+#include <libavcodec/avcodec.h>
+#include <libavformat/avformat.h>
+#include <libavutil/time.h>
+#include <libswscale/swscale.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <xcb/shm.h>
+
+// Packets waiting for the pool, the queue is dropped up to the next
+// keyframe when decoding can not keep up so the pane stays live
+#define THUMB_MAX_PACKETS 64
+// Packets decoded per task before giving the worker to another stream
+#define THUMB_BUDGET 4
+#define THUMB_MAX_EVENTS 64
+#define THUMB_REPORT_US 100000
+// A put whose completion never arrived, e.g. dropped along with its window,
+// stops blocking the pane after this long
+#define THUMB_PUT_TIMEOUT_US 1000000
+
+typedef struct {
+  mpv_event_id event_id;
+  int error;
+  const char *name;
+  mpv_format format;
+  double double_;
+  int64_t int64;
+  char text[256];
+} ThumbEvent;
+
+typedef struct {
+  const char *name;
+  xcb_connection_t *connection;
+  xcb_window_t window;
+  uint8_t depth;
+  xcb_gcontext_t gc;
+  Pool *pool;
+
+  // Owned by the main thread
+  pthread_t demux_thread;
+  int demuxing;
+  char *url;
+
+  // Set by the main thread to stop the demux thread and pending decodes
+  int stopping;
+
+  // Owned by the demux thread until the codec is published under the lock
+  AVCodecContext *codec;
+  AVRational time_base;
+  double frame_duration;
+
+  // Owned by whichever worker runs the decode task. Frames are received
+  // into scratch, which receive_frame empties before failing, and only
+  // moved to frame once one was decoded
+  AVFrame *frame;
+  AVFrame *scratch;
+  struct SwsContext *sws;
+  xcb_shm_seg_t segment;
+  uint8_t *shm;
+  int shm_width;
+  int shm_height;
+  int64_t reported_at;
+  int64_t frames;
+
+  pthread_mutex_t lock;
+  pthread_cond_t decoded;
+  int scheduled;
+  AVPacket *packets[THUMB_MAX_PACKETS];
+  int packet_head;
+  int packet_count;
+  int need_keyframe;
+  int pane_width;
+  int pane_height;
+  // Segment the server may still be reading from, cleared by the completion
+  // event routed in through player_thumb_completed
+  xcb_shm_seg_t putting;
+  int64_t put_at;
+  uint8_t thumb[ACTIVITY_THUMB_SIZE];
+  int has_thumb;
+  ThumbEvent events[THUMB_MAX_EVENTS];
+  int event_head;
+  int event_count;
+
+  // Storage for the event returned by wait_event, valid until the next call
+  mpv_event event;
+  mpv_event_property property;
+  mpv_event_log_message log;
+  mpv_event_command command;
+  mpv_node reply_values[5];
+  mpv_node_list reply_list;
+  mpv_byte_array reply_data;
+  uint8_t reply_thumb[ACTIVITY_THUMB_SIZE];
+  double double_;
+  int64_t int64;
+  char text[256];
+} Thumb;
+
+static char *reply_keys[] = {"w", "h", "stride", "format", "data"};
+
+static void push_event(Thumb *thumb, ThumbEvent event) {
+  pthread_mutex_lock(&thumb->lock);
+  if (thumb->event_count < THUMB_MAX_EVENTS) {
+    thumb->events[(thumb->event_head + thumb->event_count) % THUMB_MAX_EVENTS] = event;
+    thumb->event_count++;
+  }
+  pthread_mutex_unlock(&thumb->lock);
+}
+
+static void push_log(Thumb *thumb, const char *format, ...) {
+  ThumbEvent event = {.event_id = MPV_EVENT_LOG_MESSAGE};
+  va_list args;
+  va_start(args, format);
+  vsnprintf(event.text, sizeof(event.text), format, args);
+  va_end(args);
+  push_event(thumb, event);
+}
+
+static void push_double(Thumb *thumb, const char *name, double value) {
+  push_event(thumb, (ThumbEvent){.event_id = MPV_EVENT_PROPERTY_CHANGE, .name = name, .format = MPV_FORMAT_DOUBLE, .double_ = value});
+}
+
+static void push_int64(Thumb *thumb, const char *name, int64_t value) {
+  push_event(thumb, (ThumbEvent){.event_id = MPV_EVENT_PROPERTY_CHANGE, .name = name, .format = MPV_FORMAT_INT64, .int64 = value});
+}
+
+static int is_stopping(Thumb *thumb) {
+  return __atomic_load_n(&thumb->stopping, __ATOMIC_ACQUIRE);
+}
+
+static void release_shm(Thumb *thumb) {
+  if (!thumb->shm)
+    return;
+  xcb_shm_detach(thumb->connection, thumb->segment);
+  shmdt(thumb->shm);
+  thumb->shm = NULL;
+}
+
+// The segment is removed right after the server attached it, so it goes away with the process.
+static int allocate_shm(Thumb *thumb, int width, int height) {
+  release_shm(thumb);
+
+  int id = shmget(IPC_PRIVATE, (size_t)width * height * 4, IPC_CREAT | 0600);
+  if (id < 0)
+    return -1;
+  thumb->shm = shmat(id, NULL, 0);
+  if (thumb->shm == (void *)-1) {
+    thumb->shm = NULL;
+    shmctl(id, IPC_RMID, NULL);
+    return -1;
+  }
+
+  thumb->segment = xcb_generate_id(thumb->connection);
+  xcb_generic_error_t *error = xcb_request_check(thumb->connection, xcb_shm_attach_checked(thumb->connection, thumb->segment, id, 0));
+  shmctl(id, IPC_RMID, NULL);
+  if (error) {
+    free(error);
+    shmdt(thumb->shm);
+    thumb->shm = NULL;
+    return -1;
+  }
+
+  memset(thumb->shm, 0, (size_t)width * height * 4);
+  thumb->shm_width = width;
+  thumb->shm_height = height;
+  return 0;
+}
+
+// Samples the luma plane, every format the decoders produce here has luma first.
+static void update_thumbnail(Thumb *thumb, AVFrame *frame) {
+  uint8_t sample[ACTIVITY_THUMB_SIZE];
+  for (int y = 0; y < ACTIVITY_THUMB_HEIGHT; y++) {
+    const uint8_t *row = frame->data[0] + (int64_t)(y * frame->height / ACTIVITY_THUMB_HEIGHT) * frame->linesize[0];
+    for (int x = 0; x < ACTIVITY_THUMB_WIDTH; x++)
+      sample[y * ACTIVITY_THUMB_WIDTH + x] = row[x * frame->width / ACTIVITY_THUMB_WIDTH];
+  }
+
+  pthread_mutex_lock(&thumb->lock);
+  memcpy(thumb->thumb, sample, ACTIVITY_THUMB_SIZE);
+  thumb->has_thumb = 1;
+  pthread_mutex_unlock(&thumb->lock);
+}
+
+static void present(Thumb *thumb, AVFrame *frame) {
+  pthread_mutex_lock(&thumb->lock);
+  int width = thumb->pane_width;
+  int height = thumb->pane_height;
+  int queued = thumb->packet_count;
+  pthread_mutex_unlock(&thumb->lock);
+
+  update_thumbnail(thumb, frame);
+
+  int64_t now = av_gettime_relative();
+  if (now > thumb->reported_at + THUMB_REPORT_US) {
+    thumb->reported_at = now;
+    double pts = frame->best_effort_timestamp == AV_NOPTS_VALUE ? 0 : frame->best_effort_timestamp * av_q2d(thumb->time_base);
+    // Same meaning as mpv's, the queued packets are what has been received but not shown
+    push_double(thumb, "demuxer-cache-time", pts + queued * thumb->frame_duration);
+    push_double(thumb, "playback-time", pts);
+  }
+
+  if (width <= 0 || height <= 0)
+    return;
+  // The server reads the segment after put_image returns, scaling into it
+  // before the completion tears the image. The frame is skipped instead and
+  // the next decoded one shows.
+  pthread_mutex_lock(&thumb->lock);
+  int busy = thumb->putting && now < thumb->put_at + THUMB_PUT_TIMEOUT_US;
+  pthread_mutex_unlock(&thumb->lock);
+  if (busy)
+    return;
+  if ((width != thumb->shm_width || height != thumb->shm_height || !thumb->shm) && allocate_shm(thumb, width, height) < 0) {
+    push_log(thumb, "failed to allocate shared memory for %dx%d pane\n", width, height);
+    return;
+  }
+
+  // Letterbox inside the pane, the borders stay black from allocation
+  int scaled_width = width;
+  int scaled_height = (int64_t)frame->height * width / frame->width;
+  if (scaled_height > height) {
+    scaled_height = height;
+    scaled_width = (int64_t)frame->width * height / frame->height;
+  }
+  int x = (width - scaled_width) / 2;
+  int y = (height - scaled_height) / 2;
+
+  thumb->sws = sws_getCachedContext(thumb->sws, frame->width, frame->height, frame->format,
+                                    scaled_width, scaled_height, AV_PIX_FMT_BGR0, SWS_FAST_BILINEAR, NULL, NULL, NULL);
+  if (!thumb->sws)
+    return;
+  uint8_t *dst[] = {thumb->shm + ((int64_t)y * width + x) * 4};
+  int dst_stride[] = {width * 4};
+  sws_scale(thumb->sws, (const uint8_t *const *)frame->data, frame->linesize, 0, frame->height, dst, dst_stride);
+
+  // Marked before the request goes out, the completion can arrive right after the flush
+  pthread_mutex_lock(&thumb->lock);
+  thumb->putting = thumb->segment;
+  thumb->put_at = now;
+  pthread_mutex_unlock(&thumb->lock);
+  xcb_shm_put_image(thumb->connection, thumb->window, thumb->gc, width, height, 0, 0, width, height, 0, 0,
+                    thumb->depth, XCB_IMAGE_FORMAT_Z_PIXMAP, 1, thumb->segment, 0);
+  xcb_flush(thumb->connection);
+}
+
+static AVPacket *pop_packet(Thumb *thumb) {
+  pthread_mutex_lock(&thumb->lock);
+  AVPacket *packet = NULL;
+  if (thumb->packet_count > 0) {
+    packet = thumb->packets[thumb->packet_head];
+    thumb->packet_head = (thumb->packet_head + 1) % THUMB_MAX_PACKETS;
+    thumb->packet_count--;
+  }
+  pthread_mutex_unlock(&thumb->lock);
+  return packet;
+}
+
+static void decode_task(void *arg);
+
+static void schedule(Thumb *thumb) {
+  pthread_mutex_lock(&thumb->lock);
+  int submit = !thumb->scheduled;
+  thumb->scheduled = 1;
+  pthread_mutex_unlock(&thumb->lock);
+  if (submit)
+    pool_submit(thumb->pool, decode_task, thumb);
+}
+
+static void decode_task(void *arg) {
+  Thumb *thumb = arg;
+
+  int decoded = 0;
+  for (int i = 0; i < THUMB_BUDGET; i++) {
+    AVPacket *packet = pop_packet(thumb);
+    if (!packet)
+      break;
+    if (!is_stopping(thumb) && avcodec_send_packet(thumb->codec, packet) == 0)
+      while (avcodec_receive_frame(thumb->codec, thumb->scratch) == 0) {
+        av_frame_unref(thumb->frame);
+        av_frame_move_ref(thumb->frame, thumb->scratch);
+        decoded = 1;
+        __atomic_add_fetch(&thumb->frames, 1, __ATOMIC_RELAXED);
+      }
+    av_packet_free(&packet);
+  }
+
+  // Only the newest frame of the batch is shown
+  if (decoded && !is_stopping(thumb))
+    present(thumb, thumb->frame);
+
+  // The thumb stays scheduled until the next run is submitted, thumb_stop
+  // waits for that and can not free it in between
+  pthread_mutex_lock(&thumb->lock);
+  int more = thumb->packet_count > 0 && !is_stopping(thumb);
+  if (!more) {
+    thumb->scheduled = 0;
+    pthread_cond_broadcast(&thumb->decoded);
+  }
+  pthread_mutex_unlock(&thumb->lock);
+
+  if (more)
+    pool_submit(thumb->pool, decode_task, thumb);
+}
+
+static void queue_packet(Thumb *thumb, AVPacket *packet) {
+  pthread_mutex_lock(&thumb->lock);
+  if (thumb->packet_count == THUMB_MAX_PACKETS) {
+    for (; thumb->packet_count > 0; thumb->packet_count--) {
+      av_packet_free(&thumb->packets[thumb->packet_head]);
+      thumb->packet_head = (thumb->packet_head + 1) % THUMB_MAX_PACKETS;
+    }
+    thumb->need_keyframe = 1;
+  }
+  if (thumb->need_keyframe && !(packet->flags & AV_PKT_FLAG_KEY)) {
+    av_packet_free(&packet);
+  } else {
+    thumb->need_keyframe = 0;
+    thumb->packets[(thumb->packet_head + thumb->packet_count) % THUMB_MAX_PACKETS] = packet;
+    thumb->packet_count++;
+  }
+  pthread_mutex_unlock(&thumb->lock);
+}
+
+static int interrupt(void *opaque) {
+  return is_stopping(opaque);
+}
+
+static void *demux_main(void *arg) {
+  Thumb *thumb = arg;
+
+  AVFormatContext *format = avformat_alloc_context();
+  format->interrupt_callback.callback = interrupt;
+  format->interrupt_callback.opaque = thumb;
+  AVDictionary *options = NULL;
+  av_dict_set(&options, "rtsp_transport", "tcp", 0);
+  av_dict_set(&options, "fflags", "nobuffer", 0);
+  int err = avformat_open_input(&format, thumb->url, NULL, &options);
+  av_dict_free(&options);
+  if (err < 0) {
+    push_log(thumb, "failed to open stream: %s\n", av_err2str(err));
+    return NULL;
+  }
+
+  const AVCodec *decoder = NULL;
+  int index = -1;
+  if (avformat_find_stream_info(format, NULL) >= 0)
+    index = av_find_best_stream(format, AVMEDIA_TYPE_VIDEO, -1, -1, &decoder, 0);
+  AVCodecContext *codec = index >= 0 ? avcodec_alloc_context3(decoder) : NULL;
+  if (!codec || avcodec_parameters_to_context(codec, format->streams[index]->codecpar) < 0) {
+    push_log(thumb, "failed to find a video stream\n");
+    avcodec_free_context(&codec);
+    avformat_close_input(&format);
+    return NULL;
+  }
+
+  // Streams are decoded in parallel on the pool, not frames within a stream
+  codec->thread_count = 1;
+  codec->flags |= AV_CODEC_FLAG_LOW_DELAY;
+  if (avcodec_open2(codec, decoder, NULL) < 0) {
+    push_log(thumb, "failed to open decoder\n");
+    avcodec_free_context(&codec);
+    avformat_close_input(&format);
+    return NULL;
+  }
+
+  AVStream *stream = format->streams[index];
+  double fps = av_q2d(stream->avg_frame_rate);
+  thumb->time_base = stream->time_base;
+  thumb->frame_duration = fps > 0 ? 1 / fps : 1 / 25.0;
+  pthread_mutex_lock(&thumb->lock);
+  thumb->codec = codec;
+  pthread_mutex_unlock(&thumb->lock);
+  push_int64(thumb, "width", codec->width);
+  push_int64(thumb, "height", codec->height);
+
+  while (!is_stopping(thumb)) {
+    AVPacket *packet = av_packet_alloc();
+    err = av_read_frame(format, packet);
+    if (err == AVERROR(EAGAIN)) {
+      av_packet_free(&packet);
+      continue;
+    }
+    if (err < 0) {
+      av_packet_free(&packet);
+      if (!is_stopping(thumb))
+        push_log(thumb, "failed to read stream: %s\n", av_err2str(err));
+      break;
+    }
+    if (packet->stream_index != index) {
+      av_packet_free(&packet);
+      continue;
+    }
+    queue_packet(thumb, packet);
+    schedule(thumb);
+  }
+
+  avformat_close_input(&format);
+  return NULL;
+}
+
+static void thumb_stop(Thumb *thumb) {
+  if (!thumb->demuxing)
+    return;
+
+  __atomic_store_n(&thumb->stopping, 1, __ATOMIC_RELEASE);
+  pthread_join(thumb->demux_thread, NULL);
+  pthread_mutex_lock(&thumb->lock);
+  while (thumb->scheduled)
+    pthread_cond_wait(&thumb->decoded, &thumb->lock);
+  for (; thumb->packet_count > 0; thumb->packet_count--) {
+    av_packet_free(&thumb->packets[thumb->packet_head]);
+    thumb->packet_head = (thumb->packet_head + 1) % THUMB_MAX_PACKETS;
+  }
+  avcodec_free_context(&thumb->codec);
+  thumb->need_keyframe = 0;
+  thumb->has_thumb = 0;
+  pthread_mutex_unlock(&thumb->lock);
+
+  free(thumb->url);
+  thumb->url = NULL;
+  thumb->demuxing = 0;
+  __atomic_store_n(&thumb->stopping, 0, __ATOMIC_RELEASE);
+}
+
+static void push_screenshot(Thumb *thumb) {
+  pthread_mutex_lock(&thumb->lock);
+  int has_thumb = thumb->has_thumb;
+  pthread_mutex_unlock(&thumb->lock);
+  // The thumbnail itself is copied when the reply is read
+  push_event(thumb, (ThumbEvent){.event_id = MPV_EVENT_COMMAND_REPLY, .error = has_thumb ? 0 : MPV_ERROR_UNSUPPORTED});
+}
+
+static int thumb_command(Player *player, const char **args) {
+  Thumb *thumb = player->handle;
+  if (strcmp(args[0], "loadfile") == 0 && args[1]) {
+    thumb_stop(thumb);
+    thumb->url = strdup(args[1]);
+    thumb->demuxing = 1;
+    if (pthread_create(&thumb->demux_thread, NULL, demux_main, thumb) != 0) {
+      thumb->demuxing = 0;
+      return MPV_ERROR_UNSUPPORTED;
+    }
+  } else if (strcmp(args[0], "stop") == 0) {
+    thumb_stop(thumb);
+  } else if (strcmp(args[0], "screenshot-raw") == 0) {
+    push_screenshot(thumb);
+  }
+  return 0;
+}
+
+static int thumb_set_property_string(Player *player, const char *name, const char *data) {
+  return 0;
+}
+
+static mpv_event *thumb_wait_event(Player *player) {
+  Thumb *thumb = player->handle;
+  memset(&thumb->event, 0, sizeof(thumb->event));
+
+  pthread_mutex_lock(&thumb->lock);
+  if (thumb->event_count == 0) {
+    pthread_mutex_unlock(&thumb->lock);
+    return &thumb->event;
+  }
+  ThumbEvent event = thumb->events[thumb->event_head];
+  thumb->event_head = (thumb->event_head + 1) % THUMB_MAX_EVENTS;
+  thumb->event_count--;
+  if (event.event_id == MPV_EVENT_COMMAND_REPLY && event.error == 0)
+    memcpy(thumb->reply_thumb, thumb->thumb, ACTIVITY_THUMB_SIZE);
+  pthread_mutex_unlock(&thumb->lock);
+
+  thumb->event.event_id = event.event_id;
+  thumb->event.error = event.error;
+  switch (event.event_id) {
+  case MPV_EVENT_PROPERTY_CHANGE:
+    thumb->property = (mpv_event_property){.name = event.name, .format = event.format};
+    thumb->double_ = event.double_;
+    thumb->int64 = event.int64;
+    thumb->property.data = event.format == MPV_FORMAT_DOUBLE ? (void *)&thumb->double_ : (void *)&thumb->int64;
+    thumb->event.data = &thumb->property;
+    break;
+  case MPV_EVENT_LOG_MESSAGE:
+    memcpy(thumb->text, event.text, sizeof(thumb->text));
+    thumb->log = (mpv_event_log_message){.prefix = "thumb", .level = "error", .text = thumb->text};
+    thumb->event.data = &thumb->log;
+    break;
+  case MPV_EVENT_COMMAND_REPLY:
+    memset(&thumb->command, 0, sizeof(thumb->command));
+    if (event.error == 0) {
+      // Same shape as a screenshot-raw reply forwarded by a child process
+      thumb->reply_data = (mpv_byte_array){.data = thumb->reply_thumb, .size = ACTIVITY_THUMB_SIZE};
+      thumb->reply_values[0] = (mpv_node){.format = MPV_FORMAT_INT64, .u.int64 = ACTIVITY_THUMB_WIDTH};
+      thumb->reply_values[1] = (mpv_node){.format = MPV_FORMAT_INT64, .u.int64 = ACTIVITY_THUMB_HEIGHT};
+      thumb->reply_values[2] = (mpv_node){.format = MPV_FORMAT_INT64, .u.int64 = ACTIVITY_THUMB_WIDTH};
+      thumb->reply_values[3] = (mpv_node){.format = MPV_FORMAT_STRING, .u.string = "y8"};
+      thumb->reply_values[4] = (mpv_node){.format = MPV_FORMAT_BYTE_ARRAY, .u.ba = &thumb->reply_data};
+      thumb->reply_list = (mpv_node_list){.num = 5, .keys = reply_keys, .values = thumb->reply_values};
+      thumb->command.result = (mpv_node){.format = MPV_FORMAT_NODE_MAP, .u.list = &thumb->reply_list};
+    }
+    thumb->event.data = &thumb->command;
+    break;
+  default:
+    break;
+  }
+  return &thumb->event;
+}
+
+static void thumb_destroy(Player *player) {
+  Thumb *thumb = player->handle;
+  thumb_stop(thumb);
+  release_shm(thumb);
+  sws_freeContext(thumb->sws);
+  av_frame_free(&thumb->frame);
+  av_frame_free(&thumb->scratch);
+  xcb_free_gc(thumb->connection, thumb->gc);
+  xcb_flush(thumb->connection);
+  pthread_mutex_destroy(&thumb->lock);
+  pthread_cond_destroy(&thumb->decoded);
+  free(thumb);
+}
+
+static const PlayerBackend thumb_backend = {
+    .command = thumb_command,
+    .command_async = thumb_command,
+    .set_property_string = thumb_set_property_string,
+    .wait_event = thumb_wait_event,
+    .destroy = thumb_destroy,
+};
+
+Player *player_thumb_new(const char *name, xcb_connection_t *connection, xcb_window_t window, uint8_t depth, Pool *pool) {
+  Thumb *thumb = calloc(1, sizeof(Thumb));
+  if (thumb == NULL)
+    die("failed to allocate thumbnail player");
+  thumb->name = name;
+  thumb->connection = connection;
+  thumb->window = window;
+  thumb->depth = depth;
+  thumb->pool = pool;
+  thumb->frame = av_frame_alloc();
+  thumb->scratch = av_frame_alloc();
+  pthread_mutex_init(&thumb->lock, NULL);
+  pthread_cond_init(&thumb->decoded, NULL);
+
+  thumb->gc = xcb_generate_id(connection);
+  xcb_create_gc(connection, thumb->gc, window, 0, NULL);
+  return player_new(&thumb_backend, name, thumb);
+}
+
+int64_t player_thumb_frames(Player *player) {
+  return __atomic_load_n(&((Thumb *)player->handle)->frames, __ATOMIC_RELAXED);
+}
+
+uint8_t player_thumb_completion_type(xcb_connection_t *connection) {
+  const xcb_query_extension_reply_t *shm = xcb_get_extension_data(connection, &xcb_shm_id);
+  if (!shm || !shm->present)
+    return 0;
+  return shm->first_event + XCB_SHM_COMPLETION;
+}
+
+void player_thumb_completed(Player *player, xcb_shm_completion_event_t *event) {
+  Thumb *thumb = player->handle;
+  pthread_mutex_lock(&thumb->lock);
+  if (event->drawable == thumb->window && event->shmseg == thumb->putting)
+    thumb->putting = 0;
+  pthread_mutex_unlock(&thumb->lock);
+}
+
+void player_thumb_resize(Player *player, int width, int height) {
+  Thumb *thumb = player->handle;
+  pthread_mutex_lock(&thumb->lock);
+  thumb->pane_width = width;
+  thumb->pane_height = height;
+  pthread_mutex_unlock(&thumb->lock);
+}
+
+#endif
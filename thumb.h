@@ -0,0 +1,27 @@
+#pragma once
+
+#include "player.h"
+#include "pool.h"
+#include <stdint.h>
+#include <xcb/shm.h>
+#include <xcb/xcb.h>
+
+// Lightweight player for small panes, only built with THUMBS=1. Each stream
+// has a single demux thread, frames are decoded on the shared pool with one
+// codec thread and blitted into the pane through MIT-SHM. There is no audio,
+// OSD or seeking, commands other than loadfile, stop and screenshot-raw are
+// accepted and ignored.
+
+Player *player_thumb_new(const char *name, xcb_connection_t *connection, xcb_window_t window, uint8_t depth, Pool *pool);
+
+// Response type of the MIT-SHM completion events. Each put_image asks for
+// one and the pane skips frames until it is passed to player_thumb_completed,
+// the events arrive on the connection the caller reads.
+uint8_t player_thumb_completion_type(xcb_connection_t *connection);
+void player_thumb_completed(Player *player, xcb_shm_completion_event_t *event);
+
+// Size of the pane the video is scaled into.
+void player_thumb_resize(Player *player, int width, int height);
+
+// Frames decoded since the player was created, for the tests.
+int64_t player_thumb_frames(Player *player);
@@ -0,0 +1,163 @@
+#ifdef TRACE
+
+#define _GNU_SOURCE
+#include "trace.h"
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// Events kept per thread, a power of two. Pages are only touched once
+// written, so threads that trace little cost little memory.
+#define TRACE_BUFFER_SIZE 65536
+
+typedef struct {
+  int64_t ticks;
+  const char *name;
+  const char *arg;
+  char phase;
+} TraceEvent;
+
+typedef struct TraceBuffer {
+  const char *name;
+  int tid;
+  uint64_t written;
+  struct TraceBuffer *next;
+  TraceEvent events[TRACE_BUFFER_SIZE];
+} TraceBuffer;
+
+static __thread TraceBuffer *current_buffer;
+static TraceBuffer *buffers;
+static pthread_mutex_t buffers_lock = PTHREAD_MUTEX_INITIALIZER;
+static int64_t origin_ticks;
+static int64_t origin_ns;
+
+static int64_t clock_ns() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// Events are stamped with the TSC where there is one, reading the clock
+// costs more than the rest of an event. Ticks are converted to time when dumped.
+static inline int64_t clock_ticks() {
+#if defined(__x86_64__) || defined(__i386__)
+  return __rdtsc();
+#else
+  return clock_ns();
+#endif
+}
+
+static TraceBuffer *thread_buffer() {
+  if (current_buffer)
+    return current_buffer;
+
+  TraceBuffer *buffer = calloc(1, sizeof(TraceBuffer));
+  if (buffer == NULL)
+    abort();
+  buffer->tid = syscall(SYS_gettid);
+  pthread_mutex_lock(&buffers_lock);
+  if (buffers == NULL) {
+    origin_ticks = clock_ticks();
+    origin_ns = clock_ns();
+  }
+  buffer->next = buffers;
+  buffers = buffer;
+  pthread_mutex_unlock(&buffers_lock);
+
+  current_buffer = buffer;
+  return buffer;
+}
+
+void trace_thread(const char *name) {
+  thread_buffer()->name = name;
+}
+
+void trace_event(char phase, const char *name, const char *arg) {
+  TraceBuffer *buffer = thread_buffer();
+  uint64_t written = buffer->written;
+  TraceEvent *event = &buffer->events[written & (TRACE_BUFFER_SIZE - 1)];
+  event->ticks = clock_ticks();
+  event->name = name;
+  event->arg = arg;
+  event->phase = phase;
+  __atomic_store_n(&buffer->written, written + 1, __ATOMIC_RELEASE);
+}
+
+static void write_string(FILE *file, const char *string) {
+  fputc('"', file);
+  for (const char *c = string ? string : ""; *c; c++) {
+    if (*c == '"' || *c == '\\')
+      fprintf(file, "\\%c", *c);
+    else if ((unsigned char)*c < 0x20)
+      fprintf(file, "\\u%04x", *c);
+    else
+      fputc(*c, file);
+  }
+  fputc('"', file);
+}
+
+static void write_buffer(FILE *file, TraceBuffer *buffer, int pid, double ns_per_tick, int *first) {
+  uint64_t written = __atomic_load_n(&buffer->written, __ATOMIC_ACQUIRE);
+  uint64_t start = written > TRACE_BUFFER_SIZE ? written - TRACE_BUFFER_SIZE : 0;
+  int depth = 0;
+
+  fprintf(file, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":", *first ? "" : ",\n",
+          pid, buffer->tid);
+  write_string(file, buffer->name ? buffer->name : "thread");
+  fprintf(file, "}}");
+  *first = 0;
+
+  for (uint64_t i = start; i < written; i++) {
+    TraceEvent event = buffer->events[i & (TRACE_BUFFER_SIZE - 1)];
+    // The thread keeps tracing during the dump, skip slots it has already
+    // reused. The fence keeps the copy above from being read after the check.
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    if (__atomic_load_n(&buffer->written, __ATOMIC_RELAXED) - i >= TRACE_BUFFER_SIZE)
+      continue;
+    // Ends whose begin was overwritten would close unrelated slices
+    if (event.phase == 'E' && depth == 0)
+      continue;
+    depth += event.phase == 'B' ? 1 : event.phase == 'E' ? -1 : 0;
+
+    fprintf(file, ",\n{\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%.3f", event.phase, pid, buffer->tid, (origin_ns + (event.ticks - origin_ticks) * ns_per_tick) / 1000.0);
+    if (event.phase != 'E') {
+      fprintf(file, ",\"name\":");
+      write_string(file, event.name);
+    }
+    if (event.phase == 'i')
+      fprintf(file, ",\"s\":\"t\"");
+    if (event.arg) {
+      fprintf(file, ",\"args\":{\"stream\":");
+      write_string(file, event.arg);
+      fprintf(file, "}");
+    }
+    fprintf(file, "}");
+  }
+}
+
+int trace_dump(const char *path) {
+  FILE *file = fopen(path, "w");
+  if (file == NULL)
+    return -1;
+
+  int first = 1;
+  fprintf(file, "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n");
+  pthread_mutex_lock(&buffers_lock);
+  int64_t elapsed_ticks = clock_ticks() - origin_ticks;
+  double ns_per_tick = elapsed_ticks > 0 ? (double)(clock_ns() - origin_ns) / elapsed_ticks : 1;
+  for (TraceBuffer *buffer = buffers; buffer; buffer = buffer->next)
+    write_buffer(file, buffer, getpid(), ns_per_tick, &first);
+  pthread_mutex_unlock(&buffers_lock);
+  fprintf(file, "\n]}\n");
+
+  return fclose(file) == 0 ? 0 : -1;
+}
+
+#endif
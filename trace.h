@@ -0,0 +1,31 @@
+#pragma once
+
+// Main loop and stream lifecycle tracing, dumped in the Chrome trace event
+// format that chrome://tracing and ui.perfetto.dev open. Only built with
+// make TRACE=1, otherwise every macro compiles to nothing.
+//
+// Names and args are stored as pointers, pass string literals or strings
+// that live as long as the process such as stream names.
+
+#ifdef TRACE
+
+void trace_thread(const char *name);
+
+void trace_event(char phase, const char *name, const char *arg);
+
+// Writes the events still in every thread's ring buffer. Returns -1 on error.
+int trace_dump(const char *path);
+
+#define TRACE_THREAD(name) trace_thread(name)
+#define TRACE_BEGIN(name, arg) trace_event('B', name, arg)
+#define TRACE_END() trace_event('E', NULL, NULL)
+#define TRACE_INSTANT(name, arg) trace_event('i', name, arg)
+
+#else
+
+#define TRACE_THREAD(name) ((void)0)
+#define TRACE_BEGIN(name, arg) ((void)0)
+#define TRACE_END() ((void)0)
+#define TRACE_INSTANT(name, arg) ((void)0)
+
+#endif
@@ -0,0 +1,660 @@
+#define _GNU_SOURCE
+#include "view.h"
+#include "activity.h"
+#include "child.h"
+#include "memory.h"
+#include "thumb.h"
+#include "trace.h"
+#include "util.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+const int MEMORY_REPORT_SEC = 60;
+const int64_t MIB = 1024 * 1024;
+const int ACTIVITY_INTERVAL_MS = 500;
+const int ACTIVITY_DWELL_SEC = 5;
+const double ACTIVITY_HYSTERESIS = 0.5;
+const int OVERLAY_INTERVAL_MS = 1000;
+const char *OVERLAY_ID = "63";
+
+State *state;
+
+int view_now() { return state->now_ms / 1000; }
+
+static void x11_configure_window(xcb_window_t window, int x, int y, int width, int height, int border_width) {
+  uint32_t values[] = {x, y, MAX(width, 1), MAX(height, 1), border_width};
+  xcb_configure_window(state->connection, window,
+                       XCB_CONFIG_WINDOW_X | XCB_CONFIG_WINDOW_Y | XCB_CONFIG_WINDOW_WIDTH | XCB_CONFIG_WINDOW_HEIGHT | XCB_CONFIG_WINDOW_BORDER_WIDTH,
+                       values);
+}
+
+// Solves the grid for the current window and video sizes. Video sizes arrive
+// one property at a time and most of them leave the grid as it is, so the
+// panes are only moved when it changed. Returns COMMAND_SYNC_X11 in that case.
+static Command solve_grid() {
+  LayoutSource sources[MAX_STREAMS];
+  for (int i = 0; i < state->stream_count; i++)
+    sources[i] = state->streams[i].source;
+  LayoutGrid grid = layout_grid_solve(state->width, state->height, state->stream_count, sources);
+  if (state->grid_solved && memcmp(&grid, &state->grid, sizeof(grid)) == 0)
+    return 0;
+  state->grid = grid;
+  state->grid_solved = 1;
+
+  LayoutGrid naive = layout_grid_new(state->width, state->height, state->stream_count);
+  fprintf(stderr, "layout: %dx%d grid shows %.0f%% of the window, %dx%d grid would show %.0f%%\n",
+          state->grid.columns, state->grid.rows,
+          100 * layout_grid_displayed_area(state->grid, state->stream_count, sources) / ((double)state->width * state->height),
+          naive.columns, naive.rows,
+          100 * layout_grid_displayed_area(naive, state->stream_count, sources) / ((double)state->width * state->height));
+  return state->view == VIEW_GRID ? COMMAND_SYNC_X11 : 0;
+}
+
+LayoutGrid stream_grid() {
+  if (!state->grid_solved)
+    solve_grid();
+  return state->grid;
+}
+
+Command update_size(int width, int height) {
+  state->width = width;
+  state->height = height;
+  solve_grid();
+  return COMMAND_SYNC_X11;
+}
+
+Command toggle_fullscreen(xcb_window_t window) {
+  if (state->view == VIEW_FULLSCREEN) {
+    state->view = state->default_view;
+  } else if (window) {
+    state->view = VIEW_FULLSCREEN;
+    state->fullscreen_stream_window = window;
+  } else if (state->fullscreen_stream_window) {
+    state->view = VIEW_FULLSCREEN;
+  } else if (state->stream_count > 0) {
+    state->view = VIEW_FULLSCREEN;
+    state->fullscreen_stream_window = state->streams[0].window;
+  }
+  return COMMAND_SYNC_X11 | COMMAND_SYNC_MPV;
+}
+
+Command toggle_overlay() {
+  state->overlay = !state->overlay;
+  return COMMAND_SYNC_OVERLAY;
+}
+
+// Only remembered for replay, hovering does not change what is shown.
+Command activate_window(xcb_window_t window) {
+  state->active_stream_window = window;
+  return 0;
+}
+
+int find_stream(xcb_window_t window) {
+  for (int i = 0; i < state->stream_count; i++)
+    if (state->streams[i].window == window)
+      return i;
+  return -1;
+}
+
+Command start_replay() {
+  // Only the fullscreen stream is playing in fullscreen view, otherwise replay the hovered stream
+  xcb_window_t window = state->view == VIEW_FULLSCREEN ? state->fullscreen_stream_window : state->active_stream_window;
+  int index = find_stream(window);
+  if (index < 0)
+    return 0;
+  if (state->streams[index].replay_quota == 0) {
+    fprintf(stderr, "%s: replay is disabled\n", state->streams[index].name);
+    return 0;
+  }
+  if (state->streams[index].player == state->streams[index].thumb_player) {
+    fprintf(stderr, "%s: replay is not available in thumbnail panes\n", state->streams[index].name);
+    return 0;
+  }
+
+  // Only one stream can be replayed at a time
+  for (int i = 0; i < state->stream_count; i++)
+    if (i != index && state->streams[i].replay != REPLAY_NONE)
+      state->streams[i].replay = REPLAY_ENDING;
+
+  if (state->streams[index].replay == REPLAY_NONE) {
+    state->replay_previous_view = state->view;
+    state->replay_previous_window = state->fullscreen_stream_window;
+  }
+
+  fprintf(stderr, "%s: replaying last %d seconds\n", state->streams[index].name, state->replay_seconds);
+  state->streams[index].replay = REPLAY_STARTING;
+  state->streams[index].replay_until = view_now() + state->replay_seconds;
+  state->view = VIEW_FULLSCREEN;
+  state->fullscreen_stream_window = window;
+  return COMMAND_SYNC_X11 | COMMAND_SYNC_REPLAY;
+}
+
+static Command stop_replay(int stream_i) {
+  fprintf(stderr, "%s: returning to live\n", state->streams[stream_i].name);
+  state->streams[stream_i].replay = REPLAY_ENDING;
+  if (state->view == VIEW_FULLSCREEN && state->fullscreen_stream_window == state->streams[stream_i].window) {
+    state->view = state->replay_previous_view;
+    state->fullscreen_stream_window = state->replay_previous_window;
+  }
+  return COMMAND_SYNC_X11 | COMMAND_SYNC_REPLAY;
+}
+
+Command go_next() {
+  int index = state->stream_count - 1;
+
+  if (state->view == VIEW_FULLSCREEN)
+    for (int i = 0; i < state->stream_count; i++)
+      if (state->streams[i].window == state->fullscreen_stream_window) {
+        index = i;
+        break;
+      }
+
+  state->view = VIEW_FULLSCREEN;
+  state->fullscreen_stream_window = state->streams[(index + 1) % state->stream_count].window;
+  return COMMAND_SYNC_X11 | COMMAND_SYNC_MPV;
+}
+
+Command go_previous() {
+  int index = 0;
+
+  if (state->view == VIEW_FULLSCREEN)
+    for (int i = 0; i < state->stream_count; i++)
+      if (state->streams[i].window == state->fullscreen_stream_window) {
+        index = i;
+        break;
+      }
+
+  state->view = VIEW_FULLSCREEN;
+  state->fullscreen_stream_window = state->streams[index - 1 >= 0 ? index - 1 : state->stream_count - 1].window;
+  return COMMAND_SYNC_X11 | COMMAND_SYNC_MPV;
+}
+
+int is_mpv_playing(int index) {
+  switch (state->view) {
+  case VIEW_FULLSCREEN:
+    return state->fullscreen_stream_window == state->streams[index].window;
+  case VIEW_GRID:
+  case VIEW_LAYOUT:
+    return 1;
+  default:
+    return 0;
+  }
+}
+
+static void apply_mpv_flags_property(int stream_i, ConfigMpvFlags flags) {
+  for (int i = 0; i < flags.count; i++)
+    player_set_property_string(state->streams[stream_i].player, flags.flags[i].name, flags.flags[i].data);
+}
+
+// Returns the layout pane a stream is placed in, streams past the last pane are hidden.
+static int layout_position(int index) {
+  for (int i = 0; i < state->stream_count; i++)
+    if (state->layout_order[i] == index)
+      return i;
+  return index;
+}
+
+// Returns where a stream is shown, the size is zero when it is hidden.
+LayoutWindow stream_pane(int index) {
+  LayoutWindow hidden = {};
+
+  switch (state->view) {
+  case VIEW_FULLSCREEN: {
+    if (state->streams[index].window != state->fullscreen_stream_window)
+      return hidden;
+    LayoutWindow pane = {.x = 0, .y = 0, .width = state->width, .height = state->height};
+    return pane;
+  }
+  case VIEW_GRID:
+    return layout_grid_window(stream_grid(), index);
+  case VIEW_LAYOUT: {
+    int position = layout_position(index);
+    if (position >= state->layout_file.pane_count)
+      return hidden;
+    return layout_pane_window(state->layout_file.panes[position], state->width, state->height);
+  }
+  default:
+    return hidden;
+  }
+}
+
+static MemoryRole stream_memory_role(int index) {
+  if (!is_mpv_playing(index))
+    return MEMORY_ROLE_STOPPED;
+
+  switch (state->view) {
+  case VIEW_FULLSCREEN:
+    return MEMORY_ROLE_FULLSCREEN;
+  case VIEW_GRID:
+    return state->stream_count == 1 ? MEMORY_ROLE_FULLSCREEN : MEMORY_ROLE_PANE;
+  case VIEW_LAYOUT:
+    return layout_position(index) < state->layout_file.pane_count ? MEMORY_ROLE_PANE : MEMORY_ROLE_STANDBY;
+  default:
+    return MEMORY_ROLE_STOPPED;
+  }
+}
+
+void assign_memory() {
+  if (!state->memory_budget)
+    return;
+
+  MemoryRole roles[MAX_STREAMS];
+  int64_t back_bytes[MAX_STREAMS];
+  MemoryLimits limits[MAX_STREAMS];
+  for (int i = 0; i < state->stream_count; i++) {
+    roles[i] = stream_memory_role(i);
+    back_bytes[i] = state->streams[i].replay_quota * MIB;
+  }
+
+  int64_t over = memory_assign(state->memory_budget, roles, back_bytes, state->stream_count, limits);
+  if (over > 0)
+    fprintf(stderr, "memory: budget of %.1f MiB is %.1f MiB short for %d streams\n",
+            (double)state->memory_budget / MIB, (double)over / MIB, state->stream_count);
+
+  for (int i = 0; i < state->stream_count; i++) {
+    state->streams[i].memory_role = roles[i];
+    state->streams[i].memory_limits = limits[i];
+  }
+}
+
+// One line per playing stream, parsed by netsim/scenario.sh.
+static void report_stats() {
+  for (int i = 0; i < state->stream_count; i++)
+    if (is_mpv_playing(i))
+      fprintf(stderr, "%s: stats: t %lld latency %.3f speed %.2f\n", state->streams[i].name, (long long)state->now_ms,
+              state->streams[i].delay, state->streams[i].speed);
+}
+
+static void report_memory() {
+  int64_t used = 0;
+  int64_t assigned = 0;
+  for (int i = 0; i < state->stream_count; i++) {
+    StreamState *stream = &state->streams[i];
+    int64_t limit = stream->memory_limits.max_bytes + stream->memory_limits.max_back_bytes;
+    fprintf(stderr, "%s: memory: %s: %.1f/%.1f MiB\n", stream->name, memory_role_name(stream->memory_role),
+            (double)stream->cache_bytes / MIB, (double)limit / MIB);
+    used += stream->cache_bytes;
+    assigned += limit;
+  }
+  fprintf(stderr, "memory: %.1f/%.1f MiB used, budget %.1f MiB\n",
+          (double)used / MIB, (double)assigned / MIB, (double)state->memory_budget / MIB);
+}
+
+static void sync_mpv_memory(int index) {
+  if (!state->memory_budget)
+    return;
+
+  MemoryLimits limits = state->streams[index].memory_limits;
+  char value[32];
+
+  // Picked up by the running demuxer
+  snprintf(value, sizeof(value), "%lld", (long long)limits.max_bytes);
+  player_set_property_string(state->streams[index].player, "demuxer-max-bytes", value);
+  snprintf(value, sizeof(value), "%lld", (long long)limits.max_back_bytes);
+  player_set_property_string(state->streams[index].player, "demuxer-max-back-bytes", value);
+}
+
+static void sync_mpv_cpu(int index) {
+  if (!state->cpu)
+    return;
+
+  // A fullscreen player process can use every stream core since the others are stopped
+  cpu_set_t cpus = state->streams[index].cpus;
+  if (state->streams[index].child && state->view == VIEW_FULLSCREEN)
+    cpus = cpu_all_stream_cpus(state->cpu);
+  if (state->streams[index].child && state->streams[index].child->pid > 0)
+    cpu_pin_process(state->streams[index].child->pid, &cpus);
+
+  // Decoder threads are sized by the pane since the rendition follows it
+  LayoutWindow pane = stream_pane(index);
+  int threads = cpu_decoder_threads(pane.width, pane.height, &cpus);
+  if (threads != state->streams[index].decoder_threads) {
+    char list[256];
+    fprintf(stderr, "%s: cpu: %d decoder threads on cpus %s for %dx%d pane\n", state->streams[index].name,
+            threads, cpu_format(&cpus, list, sizeof(list)), pane.width, pane.height);
+    state->streams[index].decoder_threads = threads;
+  }
+
+  char value[32];
+  snprintf(value, sizeof(value), "%d", threads);
+  player_set_property_string(state->streams[index].player, "vd-lavc-threads", value);
+}
+
+Player *full_player(int stream_i) {
+  StreamState *stream = &state->streams[stream_i];
+  if (stream->full_player)
+    return stream->full_player;
+
+  // Threads inherit the affinity of the thread that created them
+  if (state->cpu && !state->isolate)
+    cpu_pin_thread(&stream->cpus);
+
+  stream->full_player = state->create_player(stream_i);
+
+  if (state->cpu && !state->isolate)
+    cpu_pin_thread(&state->cpu->main_cpus);
+  return stream->full_player;
+}
+
+// Small panes are decoded on the shared thumbnail pool, everything else by mpv.
+static int wants_thumb_player(int index) {
+  return state->streams[index].thumb_player && stream_pane(index).height <= state->thumb_height;
+}
+
+static void select_player(int index) {
+  StreamState *stream = &state->streams[index];
+  Player *player;
+  if (!is_mpv_playing(index) && (stream->player || stream->thumb_player))
+    // About to be stopped, no need to start mpv for it
+    player = stream->player ? stream->player : stream->thumb_player;
+  else if (wants_thumb_player(index))
+    player = stream->thumb_player;
+  else
+    player = full_player(index);
+
+  if (player == stream->player)
+    return;
+  if (stream->player) {
+    fprintf(stderr, "%s: switching to %s player\n", stream->name, player == stream->thumb_player ? "thumbnail" : "mpv");
+    player_stop(stream->player);
+  }
+  stream->player = player;
+}
+
+void sync_mpv(int index) {
+  // printf("DEBUG: syncing mpv: %d\n", index);
+  TRACE_BEGIN("sync_mpv", state->streams[index].name);
+  select_player(index);
+  sync_mpv_memory(index);
+  sync_mpv_cpu(index);
+
+  // A new file gets the whole timeout to start playing
+  state->streams[index].pinged_at = view_now();
+  // Loading the file again drops the replay buffer
+  state->streams[index].replay = REPLAY_NONE;
+
+  switch (state->view) {
+  case VIEW_FULLSCREEN: {
+    if (state->fullscreen_stream_window == state->streams[index].window) {
+      player_loadfile(state->streams[index].player, state->streams[index].main);
+      apply_mpv_flags_property(index, state->streams[index].main_mpv_flags);
+      state->streams[index].rendition = "main";
+    } else {
+      player_stop(state->streams[index].player);
+      state->streams[index].rendition = NULL;
+    }
+
+    break;
+  }
+  case VIEW_GRID: {
+    if (state->stream_count == 1) {
+      player_loadfile(state->streams[index].player, state->streams[index].main);
+      apply_mpv_flags_property(index, state->streams[index].main_mpv_flags);
+      state->streams[index].rendition = "main";
+    } else {
+      player_loadfile(state->streams[index].player, state->streams[index].sub);
+      apply_mpv_flags_property(index, state->streams[index].sub_mpv_flags);
+      state->streams[index].rendition = "sub";
+    }
+
+    break;
+  }
+  case VIEW_LAYOUT: {
+    player_loadfile(state->streams[index].player, state->streams[index].sub);
+    apply_mpv_flags_property(index, state->streams[index].sub_mpv_flags);
+    state->streams[index].rendition = "sub";
+    break;
+  }
+  }
+  TRACE_END();
+}
+
+static void sync_mpv_replay(int index) {
+  // printf("DEBUG: syncing mpv replay: %d\n", index);
+  switch (state->streams[index].replay) {
+  case REPLAY_STARTING:
+    // Already played packets are kept in the demuxer back buffer, so this never touches the network
+    player_set_speed(state->streams[index].player, 1.0);
+    player_seek(state->streams[index].player, -state->replay_seconds, "relative");
+    state->streams[index].replay = REPLAY_PLAYING;
+    break;
+  case REPLAY_ENDING:
+    // The end of the demuxer cache is the live edge
+    player_seek(state->streams[index].player, state->streams[index].cache_time, "absolute");
+    player_set_speed(state->streams[index].player, state->streams[index].speed);
+    state->streams[index].replay = REPLAY_NONE;
+    break;
+  default:
+    break;
+  }
+}
+
+// Draws the stats on top of the video, only values already observed are used.
+static void sync_mpv_overlay(int index) {
+  StreamState *stream = &state->streams[index];
+  if (!state->overlay || !stream->rendition) {
+    // Cleared once, stopped streams would otherwise get it on every refresh
+    if (!stream->overlay_shown)
+      return;
+    const char *cmd[] = {"osd-overlay", OVERLAY_ID, "none", "", NULL};
+    player_command_async(state->streams[index].player, cmd);
+    stream->overlay_shown = 0;
+    return;
+  }
+
+  char text[512];
+  snprintf(text, sizeof(text),
+           "{\\an7\\fs24\\bord2}%s (%s)\\N"
+           "latency %.2fs  speed %.2f\\N"
+           "fps %.1f  bitrate %.0f kbps\\N"
+           "drops %lld/%lld  reconnects %d",
+           stream->name, stream->rendition, stream->delay, stream->speed, stream->fps, stream->bitrate / 1000,
+           (long long)stream->frame_drops, (long long)stream->decoder_drops, stream->reloads);
+  const char *cmd[] = {"osd-overlay", OVERLAY_ID, "ass-events", text, NULL};
+  player_command_async(state->streams[index].player, cmd);
+  stream->overlay_shown = 1;
+}
+
+static void sync_mpv_speed(int index) {
+  // printf("DEBUG: syncing mpv speed: %d\n", index);
+  player_set_speed(state->streams[index].player, state->streams[index].speed);
+}
+
+void sync_x11() {
+  // printf("DEBUG: syncing x11\n");
+  if (!state->connection)
+    return;
+  TRACE_BEGIN("sync_x11", NULL);
+
+  for (int i = 0; i < state->stream_count; i++) {
+    LayoutWindow pane = stream_pane(i);
+    if (pane.width == 0) {
+      xcb_unmap_window(state->connection, state->streams[i].window);
+      continue;
+    }
+
+    int border_width = state->view == VIEW_FULLSCREEN ? 0 : BORDER_WIDTH;
+    x11_configure_window(state->streams[i].window, pane.x, pane.y,
+                         pane.width - border_width * 2, pane.height - border_width * 2, border_width);
+    xcb_map_window(state->connection, state->streams[i].window);
+#ifdef THUMBS
+    if (state->streams[i].thumb_player)
+      player_thumb_resize(state->streams[i].thumb_player, pane.width - border_width * 2, pane.height - border_width * 2);
+#endif
+  }
+
+  xcb_flush(state->connection);
+  TRACE_END();
+
+  // Resizes and layout changes sync too, only view switches are logged
+  if (state->view != state->logged_view || state->fullscreen_stream_window != state->logged_window) {
+    fprintf(stderr, "xcb: switched view with %d round trips\n", state->x11_round_trips - state->logged_round_trips);
+    state->logged_view = state->view;
+    state->logged_window = state->fullscreen_stream_window;
+    state->logged_round_trips = state->x11_round_trips;
+  }
+}
+
+// Side effects of what changed in a stream.
+static Command stream_command(StreamChange change) {
+  Command command = 0;
+  if (change & STREAM_CHANGED_SPEED)
+    command |= COMMAND_SYNC_SPEED;
+  if (change & STREAM_CHANGED_RELOAD)
+    command |= COMMAND_SYNC_MPV;
+  return command;
+}
+
+Command reload_mpv(int stream_i) {
+  return stream_command(stream_reload(&state->streams[stream_i], view_now()));
+}
+
+static void request_activity() {
+  for (int i = 0; i < state->stream_count; i++) {
+    if (!is_mpv_playing(i))
+      continue;
+    const char *cmd[] = {"screenshot-raw", "video", NULL};
+    player_command_async(state->streams[i].player, cmd);
+  }
+}
+
+// Moves the most active streams into the largest panes of the layout.
+static Command update_auto_layout() {
+  if (view_now() < state->layout_changed_at + ACTIVITY_DWELL_SEC)
+    return 0;
+
+  // Panes ordered from largest to smallest
+  int pane_count = MIN(state->layout_file.pane_count, state->stream_count);
+  int panes[MAX_STREAMS];
+  int areas[MAX_STREAMS];
+  for (int i = 0; i < pane_count; i++) {
+    LayoutWindow window = layout_pane_window(state->layout_file.panes[i], state->width, state->height);
+    int area = window.width * window.height;
+    int j = i;
+    for (; j > 0 && areas[j - 1] < area; j--) {
+      panes[j] = panes[j - 1];
+      areas[j] = areas[j - 1];
+    }
+    panes[j] = i;
+    areas[j] = area;
+  }
+
+  double scores[MAX_STREAMS];
+  for (int i = 0; i < state->stream_count; i++)
+    scores[i] = state->streams[i].activity;
+
+  if (activity_assign(scores, state->layout_order, state->stream_count, panes, pane_count, ACTIVITY_HYSTERESIS) == 0)
+    return 0;
+
+  fprintf(stderr, "activity: layout changed:");
+  for (int i = 0; i < pane_count; i++)
+    fprintf(stderr, " %s(%.1f)", state->streams[state->layout_order[i]].name, state->streams[state->layout_order[i]].activity);
+  fprintf(stderr, "\n");
+  state->layout_changed_at = view_now();
+  return COMMAND_SYNC_X11;
+}
+
+Command reload_layout_file() {
+  if (!state->layout_file_path)
+    return 0;
+  if (layout_file_reload(&state->layout_file, state->layout_file_path) < 0) {
+    fprintf(stderr, "failed to load layout '%s'\n", state->layout_file_path);
+    return 0;
+  }
+  fprintf(stderr, "reloaded layout file: %s\n", state->layout_file_path);
+  return COMMAND_SYNC_X11;
+}
+
+void view_start() {
+  // Startup round trips are logged by the caller
+  state->logged_view = state->view;
+  state->logged_window = state->fullscreen_stream_window;
+  state->logged_round_trips = state->x11_round_trips;
+  sync_x11();
+
+  assign_memory();
+  for (int i = 0; i < state->stream_count; i++)
+    sync_mpv(i);
+}
+
+int view_update(Command root_command) {
+  if (root_command & COMMAND_SYNC_MPV)
+    assign_memory();
+
+  // Rank streams by motion and promote the busiest ones
+  if (state->auto_layout && state->view == VIEW_LAYOUT && state->now_ms > state->activity_requested_at + ACTIVITY_INTERVAL_MS) {
+    root_command |= update_auto_layout();
+    request_activity();
+    state->activity_requested_at = state->now_ms;
+  }
+
+  // Refresh overlay text at a low rate
+  if (state->overlay && state->now_ms > state->overlay_updated_at + OVERLAY_INTERVAL_MS) {
+    root_command |= COMMAND_SYNC_OVERLAY;
+    state->overlay_updated_at = state->now_ms;
+  }
+
+  if (state->stats_interval_ms > 0 && state->now_ms >= state->stats_reported_at + state->stats_interval_ms) {
+    report_stats();
+    state->stats_reported_at = state->now_ms;
+  }
+
+  if (state->memory_budget && view_now() > state->memory_reported_at + MEMORY_REPORT_SEC) {
+    report_memory();
+    state->memory_reported_at = view_now();
+  }
+
+  for (int stream_i = 0; stream_i < state->stream_count; stream_i++) {
+    TRACE_BEGIN("stream", state->streams[stream_i].name);
+    Command sub_command = root_command | state->stream_commands[stream_i];
+    state->stream_commands[stream_i] = 0;
+
+    // Return to live when replay is over
+    if (state->streams[stream_i].replay == REPLAY_PLAYING && view_now() > state->streams[stream_i].replay_until) {
+      Command command = stop_replay(stream_i);
+      sub_command |= command;
+      root_command |= command & COMMAND_SYNC_X11;
+    }
+
+    // Watchdogs and mpv events, a stream loaded again below is not watched yet
+    int watched = is_mpv_playing(stream_i) && !(sub_command & COMMAND_SYNC_MPV);
+    StreamChange change = stream_step(&state->streams[stream_i], watched, view_now());
+    if (change & STREAM_CHANGED_SHUTDOWN) {
+      TRACE_END();
+      return -1;
+    }
+    if (change & STREAM_CHANGED_SOURCE)
+      root_command |= solve_grid();
+    sub_command |= stream_command(change);
+
+    // The player not in use only has stop events left, drop them
+    Player *idle_player = state->streams[stream_i].player == state->streams[stream_i].thumb_player
+                              ? state->streams[stream_i].full_player
+                              : state->streams[stream_i].thumb_player;
+    if (idle_player)
+      while (player_wait_event(idle_player)->event_id != MPV_EVENT_NONE)
+        ;
+
+    // mpv side effects
+    if (sub_command & COMMAND_SYNC_MPV)
+      sync_mpv(stream_i);
+    if (sub_command & COMMAND_SYNC_SPEED)
+      sync_mpv_speed(stream_i);
+    if (sub_command & COMMAND_SYNC_REPLAY)
+      sync_mpv_replay(stream_i);
+    if (sub_command & COMMAND_SYNC_OVERLAY)
+      sync_mpv_overlay(stream_i);
+    TRACE_END();
+  }
+
+  // X11 side effects, panes that crossed thumb-height also change players
+  if (root_command & COMMAND_SYNC_X11) {
+    for (int i = 0; i < state->stream_count; i++)
+      if (state->streams[i].thumb_player && is_mpv_playing(i) &&
+          (state->streams[i].player == state->streams[i].thumb_player) != wants_thumb_player(i))
+        sync_mpv(i);
+    sync_x11();
+  }
+  return 0;
+}
@@ -0,0 +1,149 @@
+#pragma once
+
+#include "cluster.h"
+#include "cpu.h"
+#include "layout.h"
+#include "main.h"
+#include "player.h"
+#include "pool.h"
+#include "stream.h"
+#include <stdint.h>
+#include <xcb/xcb.h>
+
+// What is shown and how the players follow it. Nothing here reads the clock
+// or waits on the X server, so the view can be driven by mock players on a
+// simulated clock, with or without a display.
+
+typedef enum {
+  COMMAND_SYNC_X11 = 0x00000001,
+  COMMAND_SYNC_MPV = 0x00000010,
+  COMMAND_SYNC_SPEED = 0x00000100,
+  COMMAND_SYNC_REPLAY = 0x00001000,
+  COMMAND_SYNC_OVERLAY = 0x00010000,
+} Command;
+
+typedef enum {
+  VIEW_GRID,
+  VIEW_FULLSCREEN,
+  VIEW_LAYOUT,
+} View;
+
+typedef struct {
+  xcb_keycode_t quit[MAX_KEYBINDINGS];
+  xcb_keycode_t home[MAX_KEYBINDINGS];
+  xcb_keycode_t next[MAX_KEYBINDINGS];
+  xcb_keycode_t previous[MAX_KEYBINDINGS];
+  xcb_keycode_t reload[MAX_KEYBINDINGS];
+  xcb_keycode_t replay[MAX_KEYBINDINGS];
+  xcb_keycode_t overlay[MAX_KEYBINDINGS];
+  xcb_keycode_t trace[MAX_KEYBINDINGS];
+} KeyMap;
+
+// Creates the mpv player of a stream, called the first time it is needed.
+typedef Player *(*ViewCreatePlayer)(int stream_i);
+
+typedef struct {
+  KeyMap key_map;
+
+  // Without a connection only the players are synced
+  xcb_connection_t *connection;
+  xcb_window_t window;
+  int width;
+  int height;
+  // Monotonic clock of the current frame, set by the caller
+  int64_t now_ms;
+  // Requests that blocked on a reply from the X server, everything else is
+  // queued and sent with xcb_flush
+  int x11_round_trips;
+  View logged_view;
+  xcb_window_t logged_window;
+  int logged_round_trips;
+
+  View view;
+  View default_view;
+  LayoutGrid grid;
+  int grid_solved;
+  const char *layout_file_path;
+  LayoutFile layout_file;
+
+  xcb_window_t active_stream_window;
+  xcb_window_t fullscreen_stream_window;
+  int replay_seconds;
+  View replay_previous_view;
+  xcb_window_t replay_previous_window;
+  int64_t memory_budget;
+  int memory_reported_at;
+  int stats_interval_ms;
+  int64_t stats_reported_at;
+  int isolate;
+  CpuTopology *cpu;
+  int auto_layout;
+  int layout_order[MAX_STREAMS];
+  int64_t activity_requested_at;
+  int layout_changed_at;
+  int overlay;
+  int64_t overlay_updated_at;
+  int thumb_height;
+  Pool *thumb_pool;
+  Pool *activity_pool;
+  ViewCreatePlayer create_player;
+  Cluster cluster;
+  ClusterState cluster_state;
+  int cluster_first;
+  int stream_count;
+  StreamState streams[MAX_STREAMS];
+  // Applied to a single stream with the next view_update
+  Command stream_commands[MAX_STREAMS];
+} State;
+
+extern const int64_t MIB;
+
+extern State *state;
+
+// Seconds of the frame clock, the unit stream timers use.
+int view_now();
+
+Command update_size(int width, int height);
+
+// Grid for the current window and video sizes.
+LayoutGrid stream_grid();
+
+Command toggle_fullscreen(xcb_window_t window);
+
+Command toggle_overlay();
+
+Command activate_window(xcb_window_t window);
+
+int find_stream(xcb_window_t window);
+
+Command start_replay();
+
+Command go_next();
+
+Command go_previous();
+
+Command reload_layout_file();
+
+Command reload_mpv(int stream_i);
+
+int is_mpv_playing(int index);
+
+// Returns where a stream is shown, the size is zero when it is hidden.
+LayoutWindow stream_pane(int index);
+
+// Creates the mpv player of a stream the first time it is needed, streams
+// that only ever show in small panes never start one.
+Player *full_player(int stream_i);
+
+void assign_memory();
+
+void sync_mpv(int index);
+
+void sync_x11();
+
+// Shows the current view and starts every player.
+void view_start();
+
+// Runs one frame: root_command applies to every stream, then each player is
+// stepped and what changed is synced. Returns -1 when a player shut down.
+int view_update(Command root_command);